@@ -183,8 +183,8 @@ void showAllBuildings() {
   for (const auto& pair : buildings) {
     const BuildingCard& card = pair.second;
     Serial.println("🏢 " + getBuildingTypeName(card.buildingType) + 
-                   " | UID: " + card.uid + 
-                   " | Age: " + String((millis() - card.firstSeen) / 1000) + "s");
+                   " | UID: " + card.uid.toString() + 
+                   " | Age: " + String((millis() - card.firstSeen()) / 1000) + "s");
   }
   Serial.println("Total: " + String(buildings.size()) + " buildings");
 }
@@ -225,9 +225,9 @@ void showBuildingsByType(uint8_t buildingType) {
   
   for (const auto& pair : buildings) {
     const BuildingCard* card = pair.second;
-    Serial.println("🏢 UID: " + card->uid + 
-                   " | First seen: " + String((millis() - card->firstSeen) / 1000) + "s ago" +
-                   " | Last seen: " + String((millis() - card->lastSeen) / 1000) + "s ago");
+    Serial.println("🏢 UID: " + card->uid.toString() + 
+                   " | First seen: " + String((millis() - card->firstSeen()) / 1000) + "s ago" +
+                   " | Last seen: " + String((millis() - card->lastSeen()) / 1000) + "s ago");
   }
   Serial.println("Total: " + String(buildings.size()) + " buildings");
 }
@@ -0,0 +1,213 @@
+#include <Arduino.h>
+#include <SPI.h>
+#include <MFRC522.h>
+#include <NFCBuildingRegistry.h>
+#include <NFCNdefParser.h>
+
+// Repeatable performance baseline for the registry and the NDEF parser.
+// Needs no reader or tags: cards are added through the API and NDEF parsing
+// runs on scripted tag images. Results are printed once to Serial.
+//
+// The database sizes that do not fit NFC_REGISTRY_MAX_CARDS are skipped. At
+// about 32 bytes per card (see getStorageBytes()),
+//   build_flags = -DNFC_REGISTRY_MAX_CARDS=1000
+// fits NFC_REGISTRY_MAX_STORAGE_BYTES on both ESP8266 and ESP32; 10000 cards
+// (345 KB) fit neither, and run in the extras/bench host build, which also
+// times scans on scripted tags. For timings of real taps use the scan
+// statistics (-DNFC_REGISTRY_STATS=1).
+
+#ifdef ESP8266
+  #define SS_PIN    D8
+  #define RST_PIN   D3
+#elif defined(ESP32)
+  #define SS_PIN    21
+  #define RST_PIN   22
+#endif
+
+// Iterations per NDEF image
+#define PARSE_ITERATIONS 10000
+
+MFRC522 mfrc522(SS_PIN, RST_PIN);
+NFCBuildingRegistry buildingRegistry(&mfrc522);
+
+const size_t kDatabaseSizes[] = {10, 100, 1000, 10000};
+
+volatile uint32_t sink; // keeps the optimizer from dropping benchmarked calls
+uint32_t benchmarkFailures; // results that differ from the expected ones
+
+// Distinct 7-byte UIDs (the NTAG format); the miss set never collides
+CardUid makeUid(uint32_t n, bool miss = false) {
+  const uint8_t bytes[7] = {
+    0x04, static_cast<uint8_t>(n >> 24), static_cast<uint8_t>(n >> 16),
+    static_cast<uint8_t>(n >> 8), static_cast<uint8_t>(n),
+    static_cast<uint8_t>(miss ? 0xA5 : 0x5A), 0x80
+  };
+  CardUid uid;
+  CardUid::fromBytes(bytes, sizeof(bytes), uid);
+  return uid;
+}
+
+void printResult(const char* name, size_t ops, uint32_t micros) {
+  Serial.printf("  %-22s %6u ops %9lu us %9.2f us/op %10.0f ops/s\n",
+                name, static_cast<unsigned>(ops), static_cast<unsigned long>(micros),
+                ops ? static_cast<double>(micros) / ops : 0.0,
+                micros ? ops * 1e6 / micros : 0.0);
+}
+
+void benchmarkDatabase(size_t cards) {
+  Serial.printf("Database with %u cards\n", static_cast<unsigned>(cards));
+  if (cards > NFCBuildingRegistry::getCapacity()) {
+    Serial.printf("  skipped (capacity %u)\n", static_cast<unsigned>(NFCBuildingRegistry::getCapacity()));
+    return;
+  }
+  buildingRegistry.clearDatabase();
+
+  uint32_t start = micros();
+  for (size_t i = 0; i < cards; i++) {
+    buildingRegistry.addBuilding(makeUid(i), static_cast<uint8_t>(i % 16));
+  }
+  printResult("addBuilding", cards, micros() - start);
+
+  uint32_t found = 0;
+  start = micros();
+  for (size_t i = 0; i < cards; i++) {
+    found += buildingRegistry.hasBuilding(makeUid(i));
+  }
+  printResult("hasBuilding (hit)", cards, micros() - start);
+
+  start = micros();
+  for (size_t i = 0; i < cards; i++) {
+    found += buildingRegistry.hasBuilding(makeUid(i, true));
+  }
+  printResult("hasBuilding (miss)", cards, micros() - start);
+  sink = found;
+
+  start = micros();
+  std::vector<BuildingCard> snapshot = buildingRegistry.snapshotBuildings();
+  printResult("snapshotBuildings", 1, micros() - start);
+  sink = snapshot.size();
+  snapshot = std::vector<BuildingCard>();
+
+  start = micros();
+  size_t visited = buildingRegistry.forEachBuilding([](const BuildingCard& card) { sink = card.buildingType; });
+  printResult("forEachBuilding", visited, micros() - start);
+
+  const size_t serializedSize = buildingRegistry.getSerializedSize();
+  uint8_t* buffer = static_cast<uint8_t*>(malloc(serializedSize));
+  if (buffer) {
+    start = micros();
+    sink = buildingRegistry.serialize(buffer, serializedSize);
+    printResult("serialize", 1, micros() - start);
+    free(buffer);
+  }
+
+  start = micros();
+  for (size_t i = 0; i < cards; i++) {
+    buildingRegistry.removeBuilding(makeUid(i));
+  }
+  printResult("removeBuilding", cards, micros() - start);
+}
+
+// NDEF area images (from page 4 on) as a reader would return them
+const uint8_t kNdefShort[] = {
+  0x03, 0x05, 0xD1, 0x01, 0x01, 'B', 7, 0xFE
+};
+// Lock control TLV and a text record ahead of the building record
+const uint8_t kNdefSkip[] = {
+  0x01, 0x03, 0xA0, 0x0C, 0x34,
+  0x03, 0x13,
+  0x91, 0x01, 0x0A, 'T', 0x02, 'e', 'n', 'b', 'u', 'i', 'l', 'd', 'i', 'n',
+  0x51, 0x01, 0x01, 'B', 9,
+  0xFE
+};
+// Declared message length runs past the data (partial read)
+const uint8_t kNdefTruncated[] = {
+  0x03, 0x40, 0xD1, 0x01, 0x20, 'T', 0x02
+};
+// Payload length larger than the message
+const uint8_t kNdefBadRecord[] = {
+  0x03, 0x05, 0xD1, 0x01, 0xF0, 'B', 7, 0xFE
+};
+// No NDEF TLV at all (blank tag)
+const uint8_t kNdefBlank[] = {
+  0x00, 0x00, 0xFE, 0x00
+};
+
+// NTAG216-sized image: extended-length TLV with many records before 'B'
+uint8_t ndefLarge[868];
+size_t buildLargeImage() {
+  const size_t recordSize = 3 + 1 + 16; // short text record with a 16-byte payload
+  const size_t records = (sizeof(ndefLarge) - 4 - 5 - 1) / recordSize;
+  const size_t messageLength = records * recordSize + 5;
+  size_t i = 0;
+  ndefLarge[i++] = 0x03;
+  ndefLarge[i++] = 0xFF;
+  ndefLarge[i++] = static_cast<uint8_t>(messageLength >> 8);
+  ndefLarge[i++] = static_cast<uint8_t>(messageLength);
+  for (size_t r = 0; r < records; r++) {
+    ndefLarge[i++] = r == 0 ? 0x91 : 0x11; // MB on the first record, SR, TNF well-known
+    ndefLarge[i++] = 0x01;
+    ndefLarge[i++] = 16;
+    ndefLarge[i++] = 'T';
+    for (size_t b = 0; b < 16; b++) {
+      ndefLarge[i++] = static_cast<uint8_t>('a' + b);
+    }
+  }
+  ndefLarge[i++] = 0x51; // ME, SR
+  ndefLarge[i++] = 0x01;
+  ndefLarge[i++] = 0x01;
+  ndefLarge[i++] = 'B';
+  ndefLarge[i++] = 3;
+  ndefLarge[i++] = 0xFE;
+  return i;
+}
+
+// expectedType is the payload of the 'B' record, or -1 if the image has none
+void benchmarkParse(const char* name, const uint8_t* data, size_t size, int expectedType) {
+  uint32_t found = 0;
+  uint32_t start = micros();
+  for (uint32_t n = 0; n < PARSE_ITERATIONS; n++) {
+    NdefRecordView record = findNdefRecord<'B'>(data, size);
+    found += record.found() ? record.payload[0] : 0x100;
+  }
+  printResult(name, PARSE_ITERATIONS, micros() - start);
+  sink = found;
+  
+  NdefRecordView record = findNdefRecord<'B'>(data, size);
+  const int type = record.found() && record.payloadLength ? record.payload[0] : -1;
+  if (type != expectedType) {
+    Serial.printf("  FAIL %s: type %d, expected %d\n", name, type, expectedType);
+    benchmarkFailures++;
+  }
+}
+
+void setup() {
+  Serial.begin(115200);
+  Serial.println();
+  Serial.println("=== NFC Building Registry Benchmark ===");
+  Serial.printf("Capacity: %u cards, %u bytes of card storage\n",
+                static_cast<unsigned>(NFCBuildingRegistry::getCapacity()),
+                static_cast<unsigned>(NFCBuildingRegistry::getStorageBytes()));
+  Serial.println();
+
+  for (size_t cards : kDatabaseSizes) {
+    benchmarkDatabase(cards);
+    yield();
+  }
+  buildingRegistry.clearDatabase();
+
+  Serial.println("NDEF parsing (findNdefRecord<'B'>)");
+  benchmarkParse("short record", kNdefShort, sizeof(kNdefShort), 7);
+  benchmarkParse("skip TLV + record", kNdefSkip, sizeof(kNdefSkip), 9);
+  benchmarkParse("truncated message", kNdefTruncated, sizeof(kNdefTruncated), -1);
+  benchmarkParse("bad payload length", kNdefBadRecord, sizeof(kNdefBadRecord), -1);
+  benchmarkParse("blank tag", kNdefBlank, sizeof(kNdefBlank), -1);
+  benchmarkParse("868-byte message", ndefLarge, buildLargeImage(), 3);
+
+  Serial.println();
+  Serial.println(benchmarkFailures ? "Done, with failures." : "Done.");
+}
+
+void loop() {
+  delay(1000);
+}
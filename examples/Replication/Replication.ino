@@ -0,0 +1,85 @@
+#include <Arduino.h>
+#include <SPI.h>
+#include <MFRC522.h>
+#include <NFCBuildingRegistry.h>
+#include <NFCRegistryReplication.h>
+#if defined(ESP8266)
+  #include <ESP8266WiFi.h>
+#else
+  #include <WiFi.h>
+#endif
+
+// Flash this sketch on several boards: a card tapped on any of them shows
+// up in the registry of all of them (ESP-NOW broadcast, no access point).
+
+// MFRC522 pin definitions
+#ifdef ESP8266
+  #define SS_PIN    D8   // SDA pin
+  #define RST_PIN   D3   // RST pin
+#elif defined(ESP32)
+  #define SS_PIN    21   // SDA pin
+  #define RST_PIN   22   // RST pin
+#endif
+
+MFRC522 mfrc522(SS_PIN, RST_PIN);
+NFCBuildingRegistry buildingRegistry(&mfrc522);
+NFCRegistryReplicator replicator(buildingRegistry);
+
+void onBuildingEvent(const BuildingEvent& event) {
+  char hex[NFC_UID_HEX_LEN + 1];
+  Serial.printf("%s %s type %u (%s)\n",
+                event.type == BuildingEvent::Added ? "Added" : "Removed",
+                event.uid.toHex(hex), event.buildingType,
+                event.reader == BuildingEvent::NoReader ? "peer" : "local reader");
+}
+
+void printStats() {
+  NFCReplicationStats stats;
+  replicator.getStats(stats);
+  Serial.printf("node %08lX clock %lu: sent %lu/%lu changes, received %lu, applied %lu, "
+                "conflicts %lu, lost %lu, resyncs %lu\n",
+                static_cast<unsigned long>(replicator.getNodeId()),
+                static_cast<unsigned long>(replicator.getClock()),
+                static_cast<unsigned long>(stats.packetsSent),
+                static_cast<unsigned long>(stats.changesSent),
+                static_cast<unsigned long>(stats.packetsReceived),
+                static_cast<unsigned long>(stats.changesApplied),
+                static_cast<unsigned long>(stats.conflictsLost),
+                static_cast<unsigned long>(stats.packetsLost),
+                static_cast<unsigned long>(stats.resyncs));
+}
+
+void setup() {
+  Serial.begin(115200);
+  Serial.println();
+  Serial.println("=== NFC Building Registry Replication ===");
+
+  SPI.begin();
+  mfrc522.PCD_Init();
+  buildingRegistry.setOnBuildingEventCallback(onBuildingEvent);
+
+  // ESP-NOW needs the radio in station mode; all boards use the same channel
+  WiFi.mode(WIFI_STA);
+  WiFi.disconnect();
+  if (!replicator.begin()) {
+    Serial.println("ESP-NOW failed to start");
+  }
+
+  Serial.println("Commands: 'p' print database, 's' replication stats, 'c' clear on all nodes");
+}
+
+void loop() {
+  buildingRegistry.poll();
+  replicator.update();
+
+  if (Serial.available()) {
+    char command = Serial.read();
+    if (command == 'p') {
+      buildingRegistry.printDatabase();
+    } else if (command == 's') {
+      printStats();
+    } else if (command == 'c') {
+      buildingRegistry.clearDatabase();
+    }
+  }
+}
@@ -0,0 +1,127 @@
+#include <Arduino.h>
+#include <MFRC522.h>
+#include <NFCBuildingRegistry.h>
+#include <chrono>
+
+// Host entry point: runs examples/Benchmark (database and NDEF parsing),
+// then times whole taps through the scan state machine on scripted tags,
+// which the sketch cannot do without a reader. Exits non-zero if a result
+// differs from the expected one.
+
+#define TAP_ITERATIONS 20000
+
+void setup();                       // examples/Benchmark/Benchmark.ino
+extern uint32_t benchmarkFailures;
+
+static MFRC522 reader;
+static NFCBuildingRegistry registry(&reader);
+
+// Tag contents from page 4 on
+static const uint8_t kShortRecord[] = {
+  0x03, 0x05, 0xD1, 0x01, 0x01, 'B', 7, 0xFE
+};
+// Lock control TLV and a text record ahead of the building record
+static const uint8_t kTwoRecords[] = {
+  0x01, 0x03, 0xA0, 0x0C, 0x34,
+  0x03, 0x13,
+  0x91, 0x01, 0x0A, 'T', 0x02, 'e', 'n', 'b', 'u', 'i', 'l', 'd', 'i', 'n',
+  0x51, 0x01, 0x01, 'B', 9,
+  0xFE
+};
+static const uint8_t kUid[7] = {0x04, 0x11, 0x22, 0x33, 0x44, 0x55, 0x80};
+
+enum class TapMode : uint8_t {
+  NewCard, // removed before every tap
+  Known,   // stays registered
+  Delete   // registered before every tap, delete mode on
+};
+
+// Taps the tag TAP_ITERATIONS times; expectedType -1 means "not registered afterwards"
+static void benchmarkTaps(const char* name, MockTag& tag, TapMode mode, int expectedType) {
+  CardUid uid;
+  CardUid::fromBytes(tag.uid, tag.uidSize, uid);
+  registry.clearDatabase();
+  registry.setDeleteMode(mode == TapMode::Delete);
+  reader.clearField();
+  reader.placeTag(&tag);
+  if (mode == TapMode::Known) {
+    registry.scanForCards(); // first read, so VerifyHash has a hash to compare
+  }
+
+  const uint32_t reads = reader.getReadCount();
+  const uint32_t fastReads = reader.getFastReadCount();
+  std::chrono::steady_clock::duration elapsed(0);
+  for (uint32_t n = 0; n < TAP_ITERATIONS; n++) {
+    if (mode == TapMode::NewCard) {
+      registry.removeBuilding(uid);
+    } else if (mode == TapMode::Delete) {
+      registry.addBuilding(uid, 1);
+    }
+    tag.state = MockTag::Idle; // lifted and put back
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    registry.scanForCards();
+    elapsed += std::chrono::steady_clock::now() - start;
+  }
+
+  const double ns = static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+  Serial.printf("  %-28s %8.0f ns/tap %5.2f READ %5.2f FAST_READ\n", name, ns / TAP_ITERATIONS,
+                static_cast<double>(reader.getReadCount() - reads) / TAP_ITERATIONS,
+                static_cast<double>(reader.getFastReadCount() - fastReads) / TAP_ITERATIONS);
+
+  const BuildingCard* card = registry.getBuilding(uid);
+  const int type = card ? card->buildingType : -1;
+  if (type != expectedType) {
+    Serial.printf("  FAIL %s: type %d, expected %d\n", name, type, expectedType);
+    benchmarkFailures++;
+  }
+  registry.setDeleteMode(false);
+}
+
+static void benchmarkIdlePolls() {
+  reader.clearField();
+  const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for (uint32_t n = 0; n < TAP_ITERATIONS; n++) {
+    registry.scanForCards();
+  }
+  const double ns = static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now() - start).count());
+  Serial.printf("  %-28s %8.0f ns/poll\n", "no card in the field", ns / TAP_ITERATIONS);
+}
+
+static void benchmarkScans() {
+  Serial.println();
+  Serial.printf("Scan pipeline on scripted tags (mock reader, %u taps each)\n", TAP_ITERATIONS);
+  MockTag shortTag = MockTag::ntag(kUid, sizeof(kUid), kShortRecord, sizeof(kShortRecord));
+  MockTag recordsTag = MockTag::ntag(kUid, sizeof(kUid), kTwoRecords, sizeof(kTwoRecords));
+  MockTag ultralightTag = recordsTag;
+  ultralightTag.fastRead = false; // NTAG-sized CC, NAKs FAST_READ
+
+  benchmarkTaps("new card, short record", shortTag, TapMode::NewCard, 7);
+  benchmarkTaps("new card, two records", recordsTag, TapMode::NewCard, 9);
+  registry.setFastReadEnabled(false);
+  benchmarkTaps("new card, READ only", recordsTag, TapMode::NewCard, 9);
+  registry.setFastReadEnabled(true);
+  benchmarkTaps("new card, FAST_READ NAK", ultralightTag, TapMode::NewCard, 9);
+
+  registry.setKnownCardPolicy(KnownCardPolicy::FullRead);
+  benchmarkTaps("re-tap, FullRead", recordsTag, TapMode::Known, 9);
+  registry.setKnownCardPolicy(KnownCardPolicy::VerifyHash);
+  benchmarkTaps("re-tap, VerifyHash", shortTag, TapMode::Known, 7);
+  // The record lies past the hashed block, so every re-tap is a full read
+  benchmarkTaps("re-tap, VerifyHash uncached", recordsTag, TapMode::Known, 9);
+  registry.setKnownCardPolicy(KnownCardPolicy::SkipRead);
+  benchmarkTaps("re-tap, SkipRead", recordsTag, TapMode::Known, 9);
+
+  benchmarkTaps("delete mode", recordsTag, TapMode::Delete, -1);
+  benchmarkIdlePolls();
+  registry.clearDatabase();
+}
+
+int main() {
+  NFCBuildingRegistry::setLogOutput(nullptr); // per-tap log lines would dominate the timings
+  setup();
+  benchmarkScans();
+  Serial.println();
+  Serial.println(benchmarkFailures ? "FAILED" : "OK");
+  return benchmarkFailures ? 1 : 0;
+}
@@ -0,0 +1,24 @@
+#include <Arduino.h>
+#include <chrono>
+#include <thread>
+#include <SPI.h>
+
+HardwareSerial Serial;
+SPIClass SPI;
+
+static const std::chrono::steady_clock::time_point bootTime = std::chrono::steady_clock::now();
+
+// Both wrap at 2^32 like on the ESP
+unsigned long millis() {
+  return static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now() - bootTime).count());
+}
+
+unsigned long micros() {
+  return static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - bootTime).count());
+}
+
+void delay(unsigned long ms) {
+  std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
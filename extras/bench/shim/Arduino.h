@@ -0,0 +1,161 @@
+#ifndef NFC_BENCH_ARDUINO_H
+#define NFC_BENCH_ARDUINO_H
+
+// Minimal Arduino core for building the library and the Benchmark sketch on
+// a PC (see ../Makefile). Only what the library uses; time comes from the
+// host's monotonic clock, Serial writes to stdout.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <string>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HEX 16
+#define DEC 10
+#define IRAM_ATTR
+#define INPUT_PULLUP 0x05
+#define FALLING 0x02
+
+// Wemos D1 mini pin numbers used by the examples
+#define D3 0
+#define D8 15
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+inline void yield() {}
+
+inline void pinMode(uint8_t, uint8_t) {}
+inline int digitalPinToInterrupt(int pin) { return pin; }
+inline void attachInterruptArg(uint8_t, void (*)(void*), void*, int) {}
+inline void detachInterrupt(uint8_t) {}
+
+class String {
+public:
+  String() {}
+  String(const char* text) : text(text ? text : "") {}
+  String(char c) : text(1, c) {}
+  String(unsigned char value, unsigned char base = 10) : text(format(value, base)) {}
+  String(int value, unsigned char base = 10) : text(base == 10 ? std::to_string(value) : format(static_cast<unsigned long>(value), base)) {}
+  String(unsigned int value, unsigned char base = 10) : text(format(value, base)) {}
+  String(long value, unsigned char base = 10) : text(base == 10 ? std::to_string(value) : format(static_cast<unsigned long>(value), base)) {}
+  String(unsigned long value, unsigned char base = 10) : text(format(value, base)) {}
+
+  const char* c_str() const { return text.c_str(); }
+  unsigned int length() const { return static_cast<unsigned int>(text.size()); }
+
+  String& operator+=(const String& other) { text += other.text; return *this; }
+  String& operator+=(const char* other) { text += other; return *this; }
+  friend String operator+(String a, const String& b) { a += b; return a; }
+  friend String operator+(String a, const char* b) { a += b; return a; }
+  friend String operator+(const char* a, const String& b) { String s(a); s += b; return s; }
+
+  bool operator==(const String& other) const { return text == other.text; }
+  bool operator!=(const String& other) const { return text != other.text; }
+  bool operator<(const String& other) const { return text < other.text; }
+
+private:
+  std::string text;
+
+  static std::string format(unsigned long value, unsigned char base) {
+    char buf[8 * sizeof(value) + 1];
+    char* p = buf + sizeof(buf) - 1;
+    *p = '\0';
+    do {
+      const unsigned digit = value % base;
+      *--p = static_cast<char>(digit < 10 ? '0' + digit : 'A' + digit - 10);
+      value /= base;
+    } while (value);
+    return p;
+  }
+};
+
+class Print {
+public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t c) = 0;
+  virtual size_t write(const uint8_t* data, size_t size) {
+    size_t n = 0;
+    while (size--) n += write(*data++);
+    return n;
+  }
+  size_t write(const char* text) { return write(reinterpret_cast<const uint8_t*>(text), strlen(text)); }
+
+  size_t print(const char* text) { return write(text); }
+  size_t print(const String& text) { return write(text.c_str()); }
+  size_t print(char c) { return write(static_cast<uint8_t>(c)); }
+  size_t print(unsigned char value, int base = DEC) { return print(String(value, static_cast<unsigned char>(base))); }
+  size_t print(int value, int base = DEC) { return print(String(value, static_cast<unsigned char>(base))); }
+  size_t print(unsigned int value, int base = DEC) { return print(String(value, static_cast<unsigned char>(base))); }
+  size_t print(long value, int base = DEC) { return print(String(value, static_cast<unsigned char>(base))); }
+  size_t print(unsigned long value, int base = DEC) { return print(String(value, static_cast<unsigned char>(base))); }
+  template <typename T> size_t println(const T& value) { return print(value) + println(); }
+  size_t println() { return write("\r\n"); }
+
+  size_t printf(const char* format, ...) __attribute__((format(printf, 2, 3))) {
+    char buf[256];
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(buf, sizeof(buf), format, args);
+    va_end(args);
+    return n > 0 ? write(buf) : 0;
+  }
+};
+
+// Stream with Arduino's timed reads: readBytes() waits up to the timeout
+// (default 1000 ms) for every missing byte
+class Stream : public Print {
+public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() = 0;
+
+  void setTimeout(unsigned long ms) { timeout = ms; }
+  unsigned long getTimeout() const { return timeout; }
+
+  size_t readBytes(char* buffer, size_t length) {
+    size_t count = 0;
+    while (count < length) {
+      int c = timedRead();
+      if (c < 0) break;
+      buffer[count++] = static_cast<char>(c);
+    }
+    return count;
+  }
+  size_t readBytes(uint8_t* buffer, size_t length) { return readBytes(reinterpret_cast<char*>(buffer), length); }
+
+protected:
+  int timedRead() {
+    const unsigned long start = millis();
+    do {
+      int c = read();
+      if (c >= 0) return c;
+      yield();
+    } while (millis() - start < timeout);
+    return -1;
+  }
+
+private:
+  unsigned long timeout = 1000;
+};
+
+class HardwareSerial : public Stream {
+public:
+  void begin(unsigned long) {}
+  size_t write(uint8_t c) override { return fputc(c, stdout) == EOF ? 0 : 1; }
+  size_t write(const uint8_t* data, size_t size) override { return fwrite(data, 1, size, stdout); }
+  int available() override { return 0; }
+  int read() override { return -1; }
+  int peek() override { return -1; }
+  using Print::write;
+};
+
+extern HardwareSerial Serial;
+
+#endif // NFC_BENCH_ARDUINO_H
@@ -0,0 +1,207 @@
+#include <MFRC522.h>
+#include <algorithm>
+
+MockTag MockTag::ntag(const uint8_t* uid, uint8_t uidSize, const uint8_t* tlvs, size_t tlvSize,
+                      uint8_t sizeCode) {
+  MockTag tag = MockTag();
+  memcpy(tag.uid, uid, uidSize);
+  tag.uidSize = uidSize;
+  tag.sak = 0x00;
+  tag.fastRead = true;
+  tag.state = Idle;
+  // UID/lock pages, CC, data area, configuration pages
+  tag.pages.assign((4 + sizeCode * 2 + 5) * 4, 0);
+  memcpy(tag.pages.data(), uid, uidSize < 9 ? uidSize : 9);
+  const uint8_t cc[4] = {0xE1, 0x10, sizeCode, 0x00};
+  memcpy(&tag.pages[12], cc, sizeof(cc));
+  memcpy(&tag.pages[16], tlvs, std::min(tlvSize, static_cast<size_t>(sizeCode) * 8));
+  return tag;
+}
+
+void MFRC522::placeTag(MockTag* tag) {
+  tag->state = MockTag::Idle;
+  field.push_back(tag);
+}
+
+void MFRC522::removeTag(MockTag* tag) {
+  field.erase(std::remove(field.begin(), field.end(), tag), field.end());
+  if (active == tag) {
+    active = nullptr;
+  }
+}
+
+void MFRC522::clearField() {
+  field.clear();
+  active = nullptr;
+}
+
+void MFRC522::deselect() {
+  if (active) {
+    active->state = MockTag::Idle;
+    active = nullptr;
+  }
+}
+
+void MFRC522::PCD_WriteRegister(PCD_Register reg, byte value) {
+  switch (reg) {
+    case CommandReg:
+      command = value & 0x0F;
+      break;
+    case ComIrqReg:
+      comIrq = (value & 0x80) ? (comIrq | (value & 0x7F)) : (comIrq & ~value);
+      break;
+    case FIFOLevelReg:
+      if (value & 0x80) fifo.clear();
+      break;
+    case FIFODataReg:
+      fifo.push_back(value);
+      break;
+    case BitFramingReg:
+      // StartSend of a REQA: the ATQA (or the timeout) is there immediately
+      if ((value & 0x80) && command == PCD_Transceive && fifo.size() == 1 && fifo[0] == PICC_CMD_REQA) {
+        byte atqa[2];
+        byte size = sizeof(atqa);
+        fifo.clear();
+        if (PICC_RequestA(atqa, &size) == STATUS_OK) {
+          fifo.assign(atqa, atqa + size);
+          comIrq |= 0x20; // RxIRq
+        } else {
+          comIrq |= 0x01; // TimerIRq
+        }
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+byte MFRC522::PCD_ReadRegister(PCD_Register reg) {
+  switch (reg) {
+    case ComIrqReg:
+      return comIrq;
+    case FIFOLevelReg:
+      return static_cast<byte>(fifo.size());
+    default:
+      return 0; // ErrorReg: no errors
+  }
+}
+
+MFRC522::StatusCode MFRC522::PCD_CalculateCRC(byte*, byte, byte* result) {
+  result[0] = 0;
+  result[1] = 0;
+  return STATUS_OK;
+}
+
+MFRC522::StatusCode MFRC522::PCD_TransceiveData(byte* sendData, byte sendLen, byte* backData, byte* backLen,
+                                                byte*, byte, bool) {
+  if (!active || sendLen < 3 || sendData[0] != 0x3A) {
+    return STATUS_TIMEOUT;
+  }
+  if (!active->fastRead) {
+    deselect(); // a NAK sends the tag back to IDLE
+    return STATUS_MIFARE_NACK;
+  }
+  const size_t start = static_cast<size_t>(sendData[1]) * 4;
+  const size_t end = (static_cast<size_t>(sendData[2]) + 1) * 4;
+  if (sendData[2] < sendData[1] || end > active->pages.size() || end - start + 2 > *backLen) {
+    deselect();
+    return STATUS_MIFARE_NACK;
+  }
+  fastReads++;
+  memcpy(backData, &active->pages[start], end - start);
+  backData[end - start] = 0;
+  backData[end - start + 1] = 0;
+  *backLen = static_cast<byte>(end - start + 2);
+  return STATUS_OK;
+}
+
+bool MFRC522::PICC_IsNewCardPresent() {
+  byte atqa[2];
+  byte size = sizeof(atqa);
+  return PICC_RequestA(atqa, &size) == STATUS_OK;
+}
+
+bool MFRC522::PICC_ReadCardSerial() {
+  return PICC_Select(&uid) == STATUS_OK;
+}
+
+MFRC522::StatusCode MFRC522::PICC_RequestA(byte* bufferATQA, byte* bufferSize) {
+  deselect();
+  for (MockTag* tag : field) {
+    if (tag->state == MockTag::Idle) {
+      if (bufferATQA && bufferSize && *bufferSize >= 2) {
+        bufferATQA[0] = 0x44;
+        bufferATQA[1] = 0x00;
+      }
+      return STATUS_OK;
+    }
+  }
+  return STATUS_TIMEOUT;
+}
+
+MFRC522::StatusCode MFRC522::PICC_WakeupA(byte* bufferATQA, byte* bufferSize) {
+  deselect();
+  for (MockTag* tag : field) {
+    tag->state = MockTag::Idle;
+  }
+  if (field.empty()) {
+    return STATUS_TIMEOUT;
+  }
+  if (bufferATQA && bufferSize && *bufferSize >= 2) {
+    bufferATQA[0] = 0x44;
+    bufferATQA[1] = 0x00;
+  }
+  return STATUS_OK;
+}
+
+// Anticollision always resolves to the first ready tag; with validBits set
+// only the tag with that UID answers
+MFRC522::StatusCode MFRC522::PICC_Select(Uid* target, byte validBits) {
+  for (MockTag* tag : field) {
+    if (tag->state != MockTag::Idle) continue;
+    if (validBits && (target->size != tag->uidSize || memcmp(target->uidByte, tag->uid, tag->uidSize) != 0)) {
+      continue;
+    }
+    tag->state = MockTag::Active;
+    active = tag;
+    target->size = tag->uidSize;
+    memcpy(target->uidByte, tag->uid, tag->uidSize);
+    target->sak = tag->sak;
+    return STATUS_OK;
+  }
+  return STATUS_TIMEOUT;
+}
+
+MFRC522::StatusCode MFRC522::PICC_HaltA() {
+  if (active) {
+    active->state = MockTag::Halted;
+    active = nullptr;
+  }
+  return STATUS_OK; // HLTA is not acknowledged
+}
+
+MFRC522::StatusCode MFRC522::MIFARE_Read(byte blockAddr, byte* buffer, byte* bufferSize) {
+  if (!buffer || !bufferSize || *bufferSize < 18) {
+    return STATUS_NO_ROOM;
+  }
+  if (!active || static_cast<size_t>(blockAddr) * 4 >= active->pages.size()) {
+    deselect();
+    return STATUS_TIMEOUT;
+  }
+  reads++;
+  // Four pages from blockAddr, rolling over to page 0 like NTAG
+  for (size_t i = 0; i < 16; i++) {
+    buffer[i] = active->pages[(static_cast<size_t>(blockAddr) * 4 + i) % active->pages.size()];
+  }
+  buffer[16] = 0;
+  buffer[17] = 0;
+  *bufferSize = 18;
+  return STATUS_OK;
+}
+
+MFRC522::PICC_Type MFRC522::PICC_GetType(byte sak) {
+  sak &= 0x7F;
+  if (sak == 0x00) return PICC_TYPE_MIFARE_UL;
+  if (sak == 0x08) return PICC_TYPE_MIFARE_1K;
+  return PICC_TYPE_UNKNOWN;
+}
@@ -0,0 +1,91 @@
+#ifndef NFC_BENCH_MFRC522_H
+#define NFC_BENCH_MFRC522_H
+
+// Scripted stand-in for the MFRC522 library: the calls the registry makes,
+// answered from MockTag images instead of a radio. Tags follow the ISO 14443
+// states the registry relies on (IDLE, HALT, ACTIVE); READ and FAST_READ
+// return page data, and FAST_READ is NAKed by tags that lack it. A REQA
+// started through the registers answers at once in ComIrqReg.
+
+#include <Arduino.h>
+#include <vector>
+
+struct MockTag {
+  uint8_t uid[10];
+  uint8_t uidSize;
+  uint8_t sak;
+  bool fastRead;              // answers FAST_READ (NTAG21x)
+  std::vector<uint8_t> pages; // 4 bytes per page, from page 0
+  
+  // NTAG21x image: UID pages, capability container (sizeCode = data area
+  // size / 8, 0x12 = NTAG213) and the given TLVs from page 4 on
+  static MockTag ntag(const uint8_t* uid, uint8_t uidSize, const uint8_t* tlvs, size_t tlvSize,
+                      uint8_t sizeCode = 0x12);
+  
+  enum State : uint8_t { Idle, Halted, Active };
+  State state;
+};
+
+class MFRC522 {
+public:
+  enum PCD_Register : byte {
+    CommandReg = 0x01 << 1, ComIEnReg = 0x02 << 1, DivIEnReg = 0x03 << 1, ComIrqReg = 0x04 << 1,
+    ErrorReg = 0x06 << 1, FIFODataReg = 0x09 << 1, FIFOLevelReg = 0x0A << 1, BitFramingReg = 0x0D << 1
+  };
+  enum PCD_Command : byte { PCD_Idle = 0x00, PCD_Transceive = 0x0C };
+  enum PICC_Command : byte { PICC_CMD_REQA = 0x26, PICC_CMD_MF_READ = 0x30 };
+  enum PICC_Type : byte { PICC_TYPE_UNKNOWN, PICC_TYPE_MIFARE_1K = 3, PICC_TYPE_MIFARE_UL = 6, PICC_TYPE_NOT_COMPLETE = 0xFF };
+  enum StatusCode : byte {
+    STATUS_OK, STATUS_ERROR, STATUS_COLLISION, STATUS_TIMEOUT, STATUS_NO_ROOM,
+    STATUS_INTERNAL_ERROR, STATUS_INVALID, STATUS_CRC_WRONG, STATUS_MIFARE_NACK = 0xFF
+  };
+  struct Uid {
+    byte size;
+    byte uidByte[10];
+    byte sak;
+  };
+  
+  Uid uid;
+  
+  MFRC522() : uid(), active(nullptr), reads(0), fastReads(0), command(PCD_Idle), fifo(), comIrq(0) {}
+  MFRC522(byte, byte) : MFRC522() {}
+  
+  // Script: tags in the field (not owned) and the exchanges made so far
+  void placeTag(MockTag* tag);
+  void removeTag(MockTag* tag);
+  void clearField();
+  uint32_t getReadCount() const { return reads; }
+  uint32_t getFastReadCount() const { return fastReads; }
+  
+  void PCD_Init() {}
+  void PCD_DumpVersionToSerial() {}
+  void PCD_WriteRegister(PCD_Register reg, byte value);
+  byte PCD_ReadRegister(PCD_Register reg);
+  void PCD_SoftPowerDown() {}
+  void PCD_SoftPowerUp() {}
+  StatusCode PCD_CalculateCRC(byte* data, byte length, byte* result);
+  StatusCode PCD_TransceiveData(byte* sendData, byte sendLen, byte* backData, byte* backLen,
+                                byte* validBits = nullptr, byte rxAlign = 0, bool checkCRC = false);
+  
+  bool PICC_IsNewCardPresent();
+  bool PICC_ReadCardSerial();
+  StatusCode PICC_RequestA(byte* bufferATQA, byte* bufferSize);
+  StatusCode PICC_WakeupA(byte* bufferATQA, byte* bufferSize);
+  StatusCode PICC_Select(Uid* uid, byte validBits = 0);
+  StatusCode PICC_HaltA();
+  StatusCode MIFARE_Read(byte blockAddr, byte* buffer, byte* bufferSize);
+  static PICC_Type PICC_GetType(byte sak);
+  
+private:
+  std::vector<MockTag*> field;
+  MockTag* active;
+  uint32_t reads;
+  uint32_t fastReads;
+  byte command;           // CommandReg
+  std::vector<byte> fifo;
+  byte comIrq;
+  
+  void deselect();
+};
+
+#endif // NFC_BENCH_MFRC522_H
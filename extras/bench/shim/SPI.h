@@ -0,0 +1,12 @@
+#ifndef NFC_BENCH_SPI_H
+#define NFC_BENCH_SPI_H
+
+// The mock reader does not use SPI
+class SPIClass {
+public:
+  void begin() {}
+};
+
+extern SPIClass SPI;
+
+#endif // NFC_BENCH_SPI_H
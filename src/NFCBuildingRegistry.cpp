@@ -1,110 +1,1527 @@
 #include "NFCBuildingRegistry.h"
+#include "NFCRegistryLog.h"
+#include "NFCNdefParser.h"
+#include <stdarg.h>
+#include <algorithm>
+#if defined(ESP32)
+  #include <esp_sleep.h>
+#endif
+
+constexpr size_t NFCBuildingRegistry::kCapacity;
+constexpr size_t NFCBuildingRegistry::kIndexSize;
+constexpr size_t NFCBuildingRegistry::kStorageBytes;
+constexpr uint16_t NFCBuildingRegistry::kNoSlot;
+constexpr size_t NFCBuildingRegistry::kNdefMaxBytes;
+constexpr size_t NFCBuildingRegistry::kTickMaxRemovals;
+constexpr uint32_t NFCBuildingRegistry::kRequestTimeoutMs;
+constexpr uint8_t BuildingEvent::NoReader;
+constexpr uint8_t NFCCardData::kMaxFields;
+constexpr uint8_t NFCCardData::kLoaded;
+constexpr size_t NFCCardData::kSize;
+
+// Writes len bytes as upper-case hex plus a terminating NUL (out must hold 2*len+1)
+static void formatUidHex(const uint8_t* bytes, uint8_t len, char* out) {
+  static const char digits[] = "0123456789ABCDEF";
+  for (uint8_t i = 0; i < len; i++) {
+    out[2 * i]     = digits[bytes[i] >> 4];
+    out[2 * i + 1] = digits[bytes[i] & 0x0F];
+  }
+  out[2 * len] = '\0';
+}
+
+static int hexNibble(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  return -1;
+}
+
+// Data area of a card, nullptr when built without NFC_REGISTRY_CARD_DATA_BYTES
+static NFCCardData* cardDataOf(BuildingCard& card) {
+#if NFC_REGISTRY_CARD_DATA_BYTES
+  return &card.data;
+#else
+  (void)card;
+  return nullptr;
+#endif
+}
+
+// Timestamp clock: whole ticks since boot and the millis() time the last one
+// started at (see nfcTimestampNow())
+static NFCTimestamp clockTicks = 0;
+static uint32_t clockTickStartMs = 0;
+#if defined(ESP32)
+static portMUX_TYPE clockMux = portMUX_INITIALIZER_UNLOCKED; // the scanner task reads it too
+#endif
+
+// Advances the clock to millis() and returns the tick with its start time
+static NFCTimestamp sampleClock(uint32_t& tickStartMs) {
+#if defined(ESP32)
+  portENTER_CRITICAL(&clockMux);
+#endif
+  const uint32_t elapsed = static_cast<uint32_t>(millis()) - clockTickStartMs; // wrap-safe
+  if (elapsed >= NFC_REGISTRY_TIMESTAMP_RESOLUTION_MS) {
+    const uint32_t ticks = elapsed / NFC_REGISTRY_TIMESTAMP_RESOLUTION_MS;
+    clockTicks = static_cast<NFCTimestamp>(clockTicks + ticks);
+    clockTickStartMs += ticks * NFC_REGISTRY_TIMESTAMP_RESOLUTION_MS;
+  }
+  const NFCTimestamp now = clockTicks;
+  tickStartMs = clockTickStartMs;
+#if defined(ESP32)
+  portEXIT_CRITICAL(&clockMux);
+#endif
+  return now;
+}
+
+NFCTimestamp nfcTimestampNow() {
+  uint32_t tickStartMs;
+  return sampleClock(tickStartMs);
+}
+
+NFCTimestamp nfcTimestamp(unsigned long ms) {
+  uint32_t tickStartMs;
+  const NFCTimestamp now = sampleClock(tickStartMs);
+  // Whole ticks from the current one, rounded down (ms may lie a little ahead)
+  const int64_t offset = static_cast<int32_t>(static_cast<uint32_t>(ms) - tickStartMs);
+  const int64_t res = NFC_REGISTRY_TIMESTAMP_RESOLUTION_MS;
+  const int64_t ticks = offset >= 0 ? offset / res : -((-offset + res - 1) / res);
+  return static_cast<NFCTimestamp>(now + ticks);
+}
+
+unsigned long nfcTimestampToMillis(NFCTimestamp stamp) {
+  uint32_t tickStartMs;
+  const NFCTimestamp age = static_cast<NFCTimestamp>(sampleClock(tickStartMs) - stamp);
+  return tickStartMs - static_cast<uint32_t>(age) * NFC_REGISTRY_TIMESTAMP_RESOLUTION_MS;
+}
+
+static Print* logOutput = &Serial;
+#if NFC_REGISTRY_STATS
+static NFCStageRecorder logStats; // ScanStage::Log, shared by all registries
+#endif
+
+void nfcLogPrintf(const char* format, ...) {
+  Print* out = logOutput;
+  if (!out) {
+    return;
+  }
+#if NFC_REGISTRY_STATS
+  const uint32_t start = micros();
+#endif
+  char line[96];
+  va_list args;
+  va_start(args, format);
+  vsnprintf(line, sizeof(line), format, args);
+  va_end(args);
+  out->println(line);
+#if NFC_REGISTRY_STATS
+  logStats.record(micros() - start);
+#endif
+}
+
+char* CardUid::toHex(char (&out)[NFC_UID_HEX_LEN + 1]) const {
+  formatUidHex(bytes, len <= NFC_UID_MAX_BYTES ? len : NFC_UID_MAX_BYTES, out);
+  return out;
+}
+
+String CardUid::toString() const {
+  char hex[NFC_UID_HEX_LEN + 1];
+  return String(toHex(hex));
+}
+
+bool CardUid::fromBytes(const uint8_t* data, uint8_t size, CardUid& out) {
+  if (!data || size == 0 || size > NFC_UID_MAX_BYTES) {
+    return false;
+  }
+  out.len = size;
+  memcpy(out.bytes, data, size);
+  return true;
+}
+
+bool CardUid::fromHex(const char* hex, CardUid& out) {
+  size_t hexLen = hex ? strlen(hex) : 0;
+  if (hexLen == 0 || (hexLen & 1) || hexLen > NFC_UID_HEX_LEN) {
+    return false;
+  }
+  
+  for (size_t i = 0; i < hexLen / 2; i++) {
+    int hi = hexNibble(hex[2 * i]);
+    int lo = hexNibble(hex[2 * i + 1]);
+    if (hi < 0 || lo < 0) {
+      return false;
+    }
+    out.bytes[i] = static_cast<uint8_t>((hi << 4) | lo);
+  }
+  out.len = static_cast<uint8_t>(hexLen / 2);
+  return true;
+}
+
+NFCBuildingRegistry::DbWriteLock::DbWriteLock(NFCBuildingRegistry& owner) : registry(owner) {
+#if NFC_REGISTRY_STATS
+  if (!registry.dbMutex.try_lock()) {
+    registry.countStat(StatLockContention);
+    StageTimer timer(registry, ScanStage::LockWait);
+    registry.dbMutex.lock();
+  } else {
+    registry.recordStage(ScanStage::LockWait, 0);
+  }
+#else
+  registry.dbMutex.lock();
+#endif
+  registry.dbSequence.store(registry.dbSequence.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release); // odd sequence before any data store
+}
+
+NFCBuildingRegistry::DbWriteLock::~DbWriteLock() {
+  registry.dbSequence.store(registry.dbSequence.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+  registry.dbMutex.unlock();
+}
+
+// Runs reader() without the lock and accepts its result only if no write
+// started or finished meanwhile. reader() may see torn data on a failed
+// attempt, so it must only index arrays with bounds-checked values. After a
+// few failed attempts (e.g. a writer preempted mid-update) the lock is taken.
+template <typename Result, typename Reader>
+Result NFCBuildingRegistry::readOptimistic(Reader reader) const {
+  for (uint8_t attempt = 0; attempt < kOptimisticRetries; attempt++) {
+    uint32_t sequence = dbSequence.load(std::memory_order_acquire);
+    if (sequence & 1) {
+      continue;
+    }
+    Result result = reader();
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (dbSequence.load(std::memory_order_relaxed) == sequence) {
+      return result;
+    }
+  }
+  NFCLockGuard<NFCRegistryLock> lock(dbMutex);
+  return reader();
+}
 
 NFCBuildingRegistry::NFCBuildingRegistry(MFRC522* reader) 
-  : mfrc522(reader), deleteMode(false) {
-  if (!mfrc522) {
-    Serial.println("ERROR: MFRC522 reader is null!");
+  : dbSequence(0), deleteMode(false), droppedEvents(0), deferredCallbacks(false), dbVersion(0), changeFloor(0) {
+  initReaders(&reader, 1);
+}
+
+NFCBuildingRegistry::NFCBuildingRegistry(MFRC522* const* readerList, uint8_t count)
+  : dbSequence(0), deleteMode(false), droppedEvents(0), deferredCallbacks(false), dbVersion(0), changeFloor(0) {
+  initReaders(readerList, count);
+}
+
+void NFCBuildingRegistry::initReaders(MFRC522* const* readerList, uint8_t count) {
+#if defined(ESP32)
+  scannerTask = nullptr;
+  scannerStopRequested = false;
+  scannerIdleDelayMs = 0;
+#endif
+#if NFC_REGISTRY_PERSISTENCE
+  persistFs = nullptr;
+  persistGeneration = 0;
+  journalRecords = 0;
+  pendingJournalCount = 0;
+  snapshotDue = false;
+#endif
+  onBuildingEventFn = nullptr;
+  onBuildingEventContext = nullptr;
+  onBatchFn = nullptr;
+  onBatchContext = nullptr;
+  memset(slotGeneration, 0, sizeof(slotGeneration));
+  resetStorageLocked();
+  
+  if (!readerList || count > kMaxReaders) {
+    NFC_LOGE("ERROR: invalid MFRC522 reader list!");
+    count = 0;
+  }
+  readerCount = count;
+  nextReader = 0;
+  fastReadEnabled = true;
+  knownCardPolicy = KnownCardPolicy::SkipRead;
+  expiryTtlMs = 0;
+  expiryTicks = 0;
+  cardDataFieldCount = 0;
+  presenceTracking = false;
+  presenceProbeIntervalMs = 100;
+  presenceHoldOffMs = 300;
+  processedCards = 0;
+  resetStats();
+  lowPowerScanning = false;
+  readersPoweredDown = false;
+  lowPowerSlotOpen = false;
+  lowPowerSlotDetected = false;
+  lowPowerPending = 0;
+  lowPowerFastMs = 100;
+  lowPowerSlowMs = 1000;
+  lowPowerIdleMs = 30000;
+  lowPowerIntervalMs = lowPowerFastMs;
+  nextScanAt = 0;
+  lastDetectionAt = 0;
+  for (uint8_t i = 0; i < kMaxReaders; i++) {
+    readers[i] = i < count ? readerList[i] : nullptr;
+    scans[i].reader = readers[i];
+    scans[i].readerIndex = i;
+    scans[i].state = ScanState::Idle;
+    scans[i].present = false;
+    scans[i].owner = this;
+    scans[i].irqPin = -1;
+    scans[i].irqArmed = false;
+    scans[i].irqPending = false;
+    scans[i].ndefMicros = 0;
+    if (i < count && !readers[i]) {
+      NFC_LOGE("ERROR: MFRC522 reader is null!");
+    }
+  }
+}
+
+NFCBuildingRegistry::~NFCBuildingRegistry() {
+#if defined(ESP32)
+  stopScannerTask();
+#endif
+  // irqHandler() must not run on a destroyed ScanContext
+  for (uint8_t i = 0; i < readerCount; i++) {
+    disableIrqDetection(i);
+  }
+}
+
+bool NFCBuildingRegistry::scanForCards() {
+#if defined(ESP32)
+  TaskHandle_t owner = scannerTask;
+  if (owner && xTaskGetCurrentTaskHandle() != owner) {
+    return false;
+  }
+#endif
+  
+  if (!lowPowerGate()) {
+    return false;
+  }
+  
+  // Check each reader and drive its state machine until the current tap (if any) has been processed
+  bool changed = false;
+  for (uint8_t i = 0; i < readerCount; i++) {
+    ScanContext& ctx = scans[i];
+    do {
+      changed = pollReader(ctx) || changed;
+    } while (ctx.state != ScanState::Idle);
+  }
+  return changed;
+}
+
+size_t NFCBuildingRegistry::scanAllCards(size_t maxCards) {
+#if defined(ESP32)
+  TaskHandle_t owner = scannerTask;
+  if (owner && xTaskGetCurrentTaskHandle() != owner) {
+    return 0;
+  }
+#endif
+  if (!lowPowerGate()) {
+    return 0;
+  }
+  
+  const uint32_t start = processedCards;
+  for (uint8_t i = 0; i < readerCount && processedCards - start < maxCards; i++) {
+    ScanContext& ctx = scans[i];
+    // First round as in scanForCards() (presence probes, IRQ and low-power rules apply)
+    uint32_t before = processedCards;
+    do {
+      pollReader(ctx);
+    } while (ctx.state != ScanState::Idle);
+    
+    // Further rounds while the previous one yielded a card. Halted cards no
+    // longer answer REQA, so each round selects one of the remaining cards.
+    while (ctx.reader && processedCards != before && processedCards - start < maxCards &&
+           ctx.reader->PICC_IsNewCardPresent()) {
+      before = processedCards;
+      ctx.state = ScanState::Select;
+      do {
+        pollReader(ctx);
+      } while (ctx.state != ScanState::Idle);
+    }
+  }
+  return processedCards - start;
+}
+
+bool NFCBuildingRegistry::poll() {
+  if (readerCount == 0) {
+    return false;
+  }
+#if defined(ESP32)
+  // The scanner task owns the readers while it runs
+  TaskHandle_t owner = scannerTask;
+  if (owner && xTaskGetCurrentTaskHandle() != owner) {
+    return false;
+  }
+#endif
+  
+  if (!lowPowerGate()) {
+    return false;
+  }
+  
+  ScanContext& ctx = scans[nextReader];
+  nextReader = static_cast<uint8_t>((nextReader + 1) % readerCount);
+  return pollReader(ctx);
+}
+
+bool NFCBuildingRegistry::pollReader(ScanContext& ctx) {
+  if (!ctx.reader) {
+    return false;
+  }
+  
+  switch (ctx.state) {
+    case ScanState::Idle: {
+      if (ctx.present && !presenceTracking) {
+        ctx.present = false; // tracking was switched off
+      }
+      // In low-power mode each reader looks for new cards once per slot
+      const uint32_t slotBit = 1u << ctx.readerIndex;
+      const bool slotDue = !lowPowerScanning || (lowPowerPending & slotBit);
+      lowPowerPending &= ~slotBit;
+      if (ctx.present) {
+        // A card is resting on the reader: only probe it every so often
+        if (static_cast<long>(millis() - ctx.nextProbe) >= 0) {
+          ctx.state = ScanState::ProbeWake;
+        }
+        return false;
+      }
+      if (!slotDue) {
+        return false;
+      }
+      // Look for new cards
+      StageTimer timer(*this, ScanStage::Detect);
+      if (ctx.irqPin >= 0) {
+        stepIrqRequest(ctx);
+      } else {
+        // The answer is collected by the next steps instead of busy-waiting
+        // for the receive timeout here
+        sendRequest(ctx.reader);
+        ctx.lastRequest = millis();
+        ctx.state = ScanState::Detect;
+      }
+      return false;
+    }
+    case ScanState::Detect:
+      stepDetect(ctx);
+      return false;
+    case ScanState::Select:
+      stepSelect(ctx);
+      return false;
+    case ScanState::ReadCapability:
+      stepReadCapability(ctx);
+      return false;
+    case ScanState::ReadNdef:
+      stepReadNdef(ctx);
+      return false;
+    case ScanState::Reselect:
+      stepReselect(ctx);
+      return false;
+    case ScanState::Complete:
+      return stepComplete(ctx);
+    case ScanState::ProbeWake:
+      stepProbeWake(ctx);
+      return false;
+    case ScanState::ProbeSelect:
+      stepProbeSelect(ctx);
+      return false;
+    case ScanState::Halt:
+      ctx.reader->PICC_HaltA();
+      ctx.state = ScanState::Idle;
+      return false;
+  }
+  return false;
+}
+
+bool NFCBuildingRegistry::isScanInProgress() const {
+  for (uint8_t i = 0; i < readerCount; i++) {
+    if (scans[i].state != ScanState::Idle) {
+      return true;
+    }
+  }
+  return false;
+}
+
+uint8_t NFCBuildingRegistry::getReaderCount() const {
+  return readerCount;
+}
+
+MFRC522* NFCBuildingRegistry::getReader(uint8_t index) const {
+  return index < readerCount ? readers[index] : nullptr;
+}
+
+void NFCBuildingRegistry::setFastReadEnabled(bool enabled) {
+  fastReadEnabled = enabled;
+}
+
+bool NFCBuildingRegistry::isFastReadEnabled() const {
+  return fastReadEnabled;
+}
+
+void NFCBuildingRegistry::setKnownCardPolicy(KnownCardPolicy policy) {
+  knownCardPolicy = policy;
+}
+
+KnownCardPolicy NFCBuildingRegistry::getKnownCardPolicy() const {
+  return knownCardPolicy;
+}
+
+bool NFCBuildingRegistry::setCardDataFields(const CardDataField* fields, uint8_t count) {
+#if defined(ESP32)
+  if (scannerTask) {
+    return false; // the scanner task reads the field table without locking
+  }
+#endif
+  if (count > NFCCardData::kMaxFields || (count && !fields)) {
+    return false;
+  }
+  for (uint8_t i = 0; i < count; i++) {
+    if (fields[i].length == 0 || fields[i].offset + fields[i].length > NFC_REGISTRY_CARD_DATA_BYTES) {
+      NFC_LOGE("ERROR: card data field %u does not fit NFC_REGISTRY_CARD_DATA_BYTES", (unsigned)i);
+      return false;
+    }
+  }
+  memcpy(cardDataFields, fields, count * sizeof(CardDataField));
+  cardDataFieldCount = count;
+  return true;
+}
+
+uint8_t NFCBuildingRegistry::getCardDataFieldCount() const {
+  return cardDataFieldCount;
+}
+
+void NFCBuildingRegistry::setPresenceTracking(bool enabled, uint32_t probeIntervalMs, uint32_t holdOffMs) {
+  presenceProbeIntervalMs = probeIntervalMs;
+  presenceHoldOffMs = holdOffMs;
+  presenceTracking = enabled;
+}
+
+bool NFCBuildingRegistry::setExpiry(uint32_t ttlMs) {
+  // Ages are computed modulo the timestamp range, so a TTL beyond half of it
+  // could not tell an expired card from a fresh one
+  const uint32_t ticks = ttlMs / NFC_REGISTRY_TIMESTAMP_RESOLUTION_MS;
+  const uint32_t limit = static_cast<uint32_t>(static_cast<NFCTimestamp>(~NFCTimestamp(0)) >> 1);
+  if (ttlMs && (ticks == 0 || ticks > limit)) {
+    return false;
+  }
+  NFCLockGuard<NFCRegistryLock> lock(dbMutex);
+  expiryTtlMs = ttlMs;
+  expiryTicks = static_cast<NFCTimestamp>(ticks);
+  return true;
+}
+
+uint32_t NFCBuildingRegistry::getExpiry() const {
+  return expiryTtlMs;
+}
+
+size_t NFCBuildingRegistry::tick(size_t maxRemovals) {
+  if (!expiryTtlMs || maxRemovals == 0) {
+    return 0;
+  }
+  if (maxRemovals > kTickMaxRemovals) maxRemovals = kTickMaxRemovals;
+  const NFCTimestamp now = nfcTimestampNow();
+  auto headExpired = [this, now]() {
+    return lruHead != kNoSlot &&
+           static_cast<NFCTimestamp>(now - slots[lruHead].lastSeenStamp) >= expiryTicks;
+  };
+  // Nothing due is the common case: check without a write lock
+  if (!readOptimistic<bool>(headExpired)) {
+    return 0;
+  }
+  
+  CardUid uids[kTickMaxRemovals];
+  uint8_t types[kTickMaxRemovals];
+  size_t removed = 0;
+  {
+    DbWriteLock lock(*this);
+    while (removed < maxRemovals && headExpired()) {
+      BuildingCard& card = slots[lruHead];
+      uids[removed] = card.uid;
+      types[removed] = card.buildingType;
+      eraseAtLocked(findIndexPos(card.uid));
+      removed++;
+    }
+  }
+  
+  for (size_t i = 0; i < removed; i++) {
+    emitEvent(BuildingEvent::Removed, types[i], uids[i], BuildingEvent::NoReader);
+    NFC_LOGI("Building expired: UID=%s, Type=%u", NFCLogHex(uids[i]).str, (unsigned)types[i]);
+  }
+#if NFC_REGISTRY_PERSISTENCE
+  if (removed) {
+    persistChanges();
+  }
+#endif
+  return removed;
+}
+
+bool NFCBuildingRegistry::isPresenceTracking() const {
+  return presenceTracking;
+}
+
+bool NFCBuildingRegistry::isCardPresent(uint8_t readerIndex, CardUid* uid) const {
+  if (readerIndex >= readerCount || !scans[readerIndex].present) {
+    return false;
+  }
+  if (uid) *uid = scans[readerIndex].presentUid;
+  return true;
+}
+
+bool NFCBuildingRegistry::setLowPowerScanning(bool enabled, uint32_t fastIntervalMs, uint32_t slowIntervalMs,
+                                              uint32_t idleTimeoutMs) {
+#if defined(ESP32)
+  if (scannerTask) {
+    return false;
+  }
+#endif
+  if (enabled) {
+    for (uint8_t i = 0; i < readerCount; i++) {
+      if (scans[i].irqPin >= 0) {
+        return false; // a powered-down reader cannot answer a REQA
+      }
+    }
+  }
+  
+  lowPowerFastMs = fastIntervalMs;
+  lowPowerSlowMs = slowIntervalMs > fastIntervalMs ? slowIntervalMs : fastIntervalMs;
+  lowPowerIdleMs = idleTimeoutMs;
+  lowPowerIntervalMs = lowPowerFastMs;
+  lowPowerPending = 0;
+  lowPowerSlotOpen = false;
+  lastDetectionAt = millis();
+  nextScanAt = lastDetectionAt; // first slot right away
+  lowPowerScanning = enabled;
+  if (!enabled) {
+    setReadersPoweredDown(false);
+  }
+  return true;
+}
+
+bool NFCBuildingRegistry::isLowPowerScanning() const {
+  return lowPowerScanning;
+}
+
+uint32_t NFCBuildingRegistry::getScanIntervalMs() const {
+  return lowPowerIntervalMs;
+}
+
+bool NFCBuildingRegistry::lowPowerGate() {
+  if (!lowPowerScanning || lowPowerPending != 0 || isScanInProgress()) {
+    return true;
+  }
+  const unsigned long now = millis();
+  if (static_cast<long>(now - nextScanAt) < 0) {
+    // Between slots only presence probes of resting cards have work to do
+    settleLowPower();
+    return isAnyCardPresent();
+  }
+  finishLowPowerSlot();
+  setReadersPoweredDown(false);
+  lowPowerPending = (readerCount == 32) ? 0xFFFFFFFFu : ((1u << readerCount) - 1);
+  lowPowerSlotOpen = true;
+  lowPowerSlotDetected = false;
+  nextScanAt = now + lowPowerIntervalMs;
+  return true;
+}
+
+void NFCBuildingRegistry::finishLowPowerSlot() {
+  if (!lowPowerSlotOpen) {
+    return;
+  }
+  lowPowerSlotOpen = false;
+  const unsigned long now = millis();
+  if (lowPowerSlotDetected) {
+    lastDetectionAt = now;
+    lowPowerIntervalMs = lowPowerFastMs;
+  } else if (now - lastDetectionAt >= lowPowerIdleMs && lowPowerIntervalMs < lowPowerSlowMs) {
+    // Back off gradually; the slow interval bounds the detection latency
+    lowPowerIntervalMs = lowPowerIntervalMs * 2 < lowPowerSlowMs ? lowPowerIntervalMs * 2 : lowPowerSlowMs;
+  }
+}
+
+void NFCBuildingRegistry::settleLowPower() {
+  if (lowPowerPending != 0 || isScanInProgress()) {
+    return;
+  }
+  finishLowPowerSlot();
+  if (!isAnyCardPresent()) {
+    setReadersPoweredDown(true);
+  }
+}
+
+void NFCBuildingRegistry::setReadersPoweredDown(bool down) {
+  if (readersPoweredDown == down) {
+    return;
+  }
+  for (uint8_t i = 0; i < readerCount; i++) {
+    if (!readers[i]) continue;
+    if (down) {
+      readers[i]->PCD_SoftPowerDown(); // RF field and analog part off, register contents kept
+    } else {
+      readers[i]->PCD_SoftPowerUp();   // waits for the oscillator
+    }
+  }
+  readersPoweredDown = down;
+}
+
+bool NFCBuildingRegistry::isAnyCardPresent() const {
+  for (uint8_t i = 0; i < readerCount; i++) {
+    if (scans[i].present) {
+      return true;
+    }
+  }
+  return false;
+}
+
+uint32_t NFCBuildingRegistry::getTimeToNextScan() const {
+  if (!lowPowerScanning || lowPowerPending != 0 || isScanInProgress()) {
+    return 0;
+  }
+  const unsigned long now = millis();
+  long wait = static_cast<long>(nextScanAt - now);
+  for (uint8_t i = 0; i < readerCount; i++) {
+    if (scans[i].present) {
+      long probe = static_cast<long>(scans[i].nextProbe - now);
+      if (probe < wait) wait = probe;
+    }
+  }
+  return wait > 0 ? static_cast<uint32_t>(wait) : 0;
+}
+
+void NFCBuildingRegistry::sleepUntilNextScan() {
+  if (!lowPowerScanning) {
+    return;
+  }
+  settleLowPower();
+  uint32_t sleepMs = getTimeToNextScan();
+  if (sleepMs == 0) {
+    return;
+  }
+#if defined(ESP32)
+  esp_sleep_enable_timer_wakeup(static_cast<uint64_t>(sleepMs) * 1000);
+  esp_light_sleep_start();
+#else
+  delay(sleepMs);
+#endif
+}
+
+bool NFCBuildingRegistry::enableIrqDetection(uint8_t readerIndex, uint8_t irqPin, uint32_t requestIntervalMs) {
+  if (readerIndex >= readerCount || !readers[readerIndex]) {
+    return false;
+  }
+#if defined(ESP32)
+  if (scannerTask) {
+    return false; // the task owns the reader's SPI traffic
+  }
+#endif
+  if (lowPowerScanning) {
+    return false;
+  }
+  disableIrqDetection(readerIndex);
+  
+  ScanContext& ctx = scans[readerIndex];
+  // Push-pull IRQ output, active low, asserted on RxIRq only. The MFRC522
+  // also raises RxIRq during our own transceives; irqArmed filters those out.
+  ctx.reader->PCD_WriteRegister(MFRC522::DivIEnReg, 0x80);
+  ctx.reader->PCD_WriteRegister(MFRC522::ComIEnReg, 0xA0);
+  ctx.irqRequestIntervalMs = requestIntervalMs;
+  ctx.irqArmed = false;
+  ctx.irqPending = false;
+  ctx.irqPin = irqPin;
+  pinMode(irqPin, INPUT_PULLUP);
+  attachInterruptArg(digitalPinToInterrupt(irqPin), irqHandler, &ctx, FALLING);
+  return true;
+}
+
+void NFCBuildingRegistry::disableIrqDetection(uint8_t readerIndex) {
+  if (readerIndex >= readerCount || scans[readerIndex].irqPin < 0) {
+    return;
+  }
+  ScanContext& ctx = scans[readerIndex];
+  detachInterrupt(digitalPinToInterrupt(ctx.irqPin));
+  ctx.irqPin = -1;
+  ctx.irqArmed = false;
+  // Back to the reset values; the next PICC_IsNewCardPresent() stops any pending REQA
+  ctx.reader->PCD_WriteRegister(MFRC522::ComIEnReg, 0x80);
+  ctx.reader->PCD_WriteRegister(MFRC522::DivIEnReg, 0x00);
+}
+
+bool NFCBuildingRegistry::isIrqDetectionEnabled(uint8_t readerIndex) const {
+  return readerIndex < readerCount && scans[readerIndex].irqPin >= 0;
+}
+
+void IRAM_ATTR NFCBuildingRegistry::irqHandler(void* arg) {
+  ScanContext* ctx = static_cast<ScanContext*>(arg);
+  ctx->irqPending.store(true, std::memory_order_release);
+#if defined(ESP32)
+  TaskHandle_t task = ctx->owner->scannerTask;
+  if (task) {
+    BaseType_t woken = pdFALSE;
+    vTaskNotifyGiveFromISR(task, &woken);
+    if (woken) {
+      portYIELD_FROM_ISR();
+    }
+  }
+#endif
+}
+
+void NFCBuildingRegistry::stepIrqRequest(ScanContext& ctx) {
+  MFRC522* reader = ctx.reader;
+  if (ctx.irqArmed && ctx.irqPending.exchange(false, std::memory_order_acquire)) {
+    // A card answered the last REQA and is READY: go straight to anticollision
+    ctx.irqArmed = false;
+    reader->PCD_WriteRegister(MFRC522::ComIrqReg, 0x7F);
+    ctx.state = ScanState::Select;
+    return;
+  }
+  
+  unsigned long now = millis();
+  if (ctx.irqArmed && now - ctx.lastRequest < ctx.irqRequestIntervalMs) {
+    return;
+  }
+  // Send a REQA and return at once; the answer (if any) is signalled on the
+  // IRQ pin. Clearing the IRQs in sendRequest() releases the pin.
+  sendRequest(reader);
+  ctx.irqPending = false;
+  ctx.irqArmed = true;
+  ctx.lastRequest = now;
+}
+
+void NFCBuildingRegistry::sendRequest(MFRC522* reader) {
+  // What PICC_RequestA() sends, minus its wait: a few register writes
+  reader->PCD_WriteRegister(MFRC522::CommandReg, MFRC522::PCD_Idle); // abort the previous receive
+  reader->PCD_WriteRegister(MFRC522::ComIrqReg, 0x7F);                // clear all IRQs
+  reader->PCD_WriteRegister(MFRC522::FIFOLevelReg, 0x80);             // flush FIFO
+  reader->PCD_WriteRegister(MFRC522::FIFODataReg, MFRC522::PICC_CMD_REQA);
+  reader->PCD_WriteRegister(MFRC522::CommandReg, MFRC522::PCD_Transceive);
+  reader->PCD_WriteRegister(MFRC522::BitFramingReg, 0x87);            // StartSend, 7-bit short frame
+}
+
+void NFCBuildingRegistry::stepDetect(ScanContext& ctx) {
+  MFRC522* reader = ctx.reader;
+  StageTimer timer(*this, ScanStage::Detect);
+  const byte irq = reader->PCD_ReadRegister(MFRC522::ComIrqReg);
+  if (irq & 0x20) {
+    // RxIRq. Like PICC_IsNewCardPresent(): a card is there if the answer is
+    // a clean 2-byte ATQA or a collision of several ATQAs.
+    const byte error = reader->PCD_ReadRegister(MFRC522::ErrorReg);
+    if ((error & 0x13) == 0 &&
+        ((error & 0x08) || reader->PCD_ReadRegister(MFRC522::FIFOLevelReg) == 2)) {
+      ctx.state = ScanState::Select;
+      lowPowerSlotDetected = true;
+    } else {
+      ctx.state = ScanState::Idle;
+    }
+    return;
+  }
+  // TimerIRq: nobody answered within the receive timeout set up by
+  // PCD_Init() (25 ms). The millis() bound covers a reader that never
+  // raises it (unplugged, or its timer reprogrammed).
+  if ((irq & 0x01) || millis() - ctx.lastRequest > kRequestTimeoutMs) {
+    reader->PCD_WriteRegister(MFRC522::CommandReg, MFRC522::PCD_Idle);
+    ctx.state = ScanState::Idle;
+  }
+}
+
+void NFCBuildingRegistry::stepSelect(ScanContext& ctx) {
+  MFRC522* reader = ctx.reader;
+  // Select one of the cards
+  bool selected;
+  {
+    StageTimer timer(*this, ScanStage::Select);
+    selected = reader->PICC_ReadCardSerial();
+  }
+  if (!selected || !CardUid::fromBytes(reader->uid.uidByte, reader->uid.size, ctx.uid)) {
+    ctx.state = ScanState::Idle;
+    return;
+  }
+  countStat(StatReads);
+  onCardSelected(ctx);
+}
+
+void NFCBuildingRegistry::onCardSelected(ScanContext& ctx) {
+  MFRC522* reader = ctx.reader;
+  ctx.ndefSize = 0;
+  ctx.ndefMicros = 0;
+  ctx.typeFromNdef = false;
+  ctx.blockHash = 0;
+  ctx.dataValid = false;
+  
+  // The resting card answered a REQA again - just refresh its presence
+  if (ctx.present && ctx.uid == ctx.presentUid) {
+    ctx.lastResponse = millis();
+    ctx.state = ScanState::Halt;
+    return;
+  }
+  
+  // The tag content only matters for cards about to be added: delete mode and
+  // re-taps of registered cards need nothing beyond the UID
+  // (a card whose data has not been read from the tag yet counts as new)
+  bool known = !deleteMode && knownCardPolicy != KnownCardPolicy::FullRead &&
+               (cardDataFieldCount ? isCardDataLoaded(ctx.uid) : hasBuilding(ctx.uid));
+  ctx.verifyHash = known && knownCardPolicy == KnownCardPolicy::VerifyHash;
+  ctx.skipNdef = deleteMode || (known && !ctx.verifyHash);
+  if (ctx.skipNdef) {
+    ctx.state = ScanState::Complete;
+    return;
+  }
+  
+  // Only NTAG and similar NFC Forum Type 2 tags carry NDEF we can read
+  MFRC522::PICC_Type piccType = reader->PICC_GetType(reader->uid.sak);
+  ctx.state = (piccType == MFRC522::PICC_TYPE_MIFARE_UL) ? ScanState::ReadCapability : ScanState::Complete;
+}
+
+void NFCBuildingRegistry::stepReadCapability(ScanContext& ctx) {
+  StageTimer timer(ctx.ndefMicros);
+  // Working buffer for MFRC522::MIFARE_Read (16 bytes of data + 2 CRC bytes)
+  byte buffer[18];
+  byte size = sizeof(buffer);
+  
+  // Read capability container (CC) at page 3 and check NDEF magic number 0xE1
+  MFRC522::StatusCode status = ctx.reader->MIFARE_Read(3, buffer, &size);
+  if (status != MFRC522::STATUS_OK || buffer[0] != 0xE1) {
+    ctx.state = ScanState::Complete;
+    return;
+  }
+  
+  // Re-tap under VerifyHash: an unchanged first block means the cached parse
+  // (the stored building type) is still valid
+  ctx.blockHash = hashNdefBlock(buffer);
+  if (ctx.verifyHash && cachedNdefHash(ctx.uid) == ctx.blockHash) {
+    countStat(StatHashHits);
+    ctx.skipNdef = true;
+    ctx.state = ScanState::Complete;
+    return;
+  }
+  
+  // CC byte 2 is the data area size / 8. NTAG213/215/216 (0x12/0x3E/0x6D) support FAST_READ.
+  uint8_t sizeCode = buffer[2];
+  ctx.tagBytes = static_cast<size_t>(sizeCode) * 8;
+  ctx.fastRead = fastReadEnabled && (sizeCode == 0x12 || sizeCode == 0x3E || sizeCode == 0x6D);
+  
+  // A READ returns 4 pages, so pages 4..6 of the NDEF area come for free
+  memcpy(ctx.ndef, buffer + 4, 12);
+  ctx.ndefSize = 12;
+  ctx.nextPage = kNdefFirstPage + 3;
+  planNdefRead(ctx);
+}
+
+void NFCBuildingRegistry::planNdefRead(ScanContext& ctx) {
+  // Find where the NDEF message TLV ends, using the TLVs read so far
+  NdefMessageSpan message = findNdefMessage(ctx.ndef, ctx.ndefSize);
+  size_t target;
+  if (message.status == NdefParseStatus::Found) {
+    target = message.offset + message.length;
+  } else if (message.status == NdefParseStatus::NotFound) {
+    target = ctx.ndefSize; // Terminator TLV without an NDEF message - nothing more to read
+  } else {
+    // TLV headers continue past what we have - fetch one more block and re-plan
+    target = ctx.ndefSize + 16;
+  }
+  
+  // Never read past the tag's data area or our buffer
+  if (ctx.tagBytes && target > ctx.tagBytes) target = ctx.tagBytes;
+  if (target > kNdefMaxBytes) target = kNdefMaxBytes;
+  
+  ctx.readTarget = target;
+  ctx.state = (ctx.ndefSize < target) ? ScanState::ReadNdef : ScanState::Complete;
+}
+
+void NFCBuildingRegistry::stepReadNdef(ScanContext& ctx) {
+  StageTimer timer(ctx.ndefMicros);
+  size_t missing = ctx.readTarget - ctx.ndefSize;
+  size_t pages = (missing + 3) / 4;
+  
+  if (ctx.fastRead) {
+    if (pages > kFastReadMaxPages) pages = kFastReadMaxPages;
+    uint8_t endPage = static_cast<uint8_t>(ctx.nextPage + pages - 1);
+    if (!fastReadPages(ctx.reader, ctx.nextPage, endPage, ctx.ndef + ctx.ndefSize)) {
+      // The tag NAKed (e.g. Ultralight C with an NTAG-sized CC) and dropped to IDLE.
+      // Re-activate it and continue with plain READs.
+      ctx.fastRead = false;
+      ctx.state = ScanState::Reselect;
+      return;
+    }
+    ctx.ndefSize += pages * 4;
+    ctx.nextPage = static_cast<uint8_t>(ctx.nextPage + pages);
+  } else {
+    byte buffer[18];
+    byte size = sizeof(buffer);
+    MFRC522::StatusCode status = ctx.reader->MIFARE_Read(ctx.nextPage, buffer, &size);
+    if (status != MFRC522::STATUS_OK) {
+      ctx.state = ScanState::Complete; // keep whatever was read so far
+      return;
+    }
+    
+    // Copy up to 16 bytes of data to NDEF buffer (skip last 2 CRC bytes)
+    size_t room = kNdefMaxBytes - ctx.ndefSize;
+    size_t chunk = room < 16 ? room : 16;
+    memcpy(ctx.ndef + ctx.ndefSize, buffer, chunk);
+    ctx.ndefSize += chunk;
+    ctx.nextPage = static_cast<uint8_t>(ctx.nextPage + 4);
+  }
+  
+  planNdefRead(ctx);
+}
+
+void NFCBuildingRegistry::stepReselect(ScanContext& ctx) {
+  StageTimer timer(ctx.ndefMicros);
+  MFRC522* reader = ctx.reader;
+  byte atqa[2];
+  byte atqaSize = sizeof(atqa);
+  // WUPA + SELECT with the already known UID (no anticollision needed)
+  if (reader->PICC_WakeupA(atqa, &atqaSize) != MFRC522::STATUS_OK ||
+      reader->PICC_Select(&reader->uid, static_cast<byte>(reader->uid.size * 8)) != MFRC522::STATUS_OK) {
+    ctx.state = ScanState::Complete;
+    return;
+  }
+  ctx.state = ScanState::ReadNdef;
+}
+
+bool NFCBuildingRegistry::fastReadPages(MFRC522* reader, uint8_t startPage, uint8_t endPage, uint8_t* out) {
+  // FAST_READ, start page, end page, CRC_A
+  byte command[5] = { 0x3A, startPage, endPage, 0, 0 };
+  if (reader->PCD_CalculateCRC(command, 3, &command[3]) != MFRC522::STATUS_OK) {
+    return false;
+  }
+  
+  const size_t dataBytes = static_cast<size_t>(endPage - startPage + 1) * 4;
+  byte response[kFastReadMaxPages * 4 + 2];
+  byte responseSize = static_cast<byte>(dataBytes + 2);
+  MFRC522::StatusCode status = reader->PCD_TransceiveData(command, sizeof(command), response,
+                                                          &responseSize, nullptr, 0, true);
+  if (status != MFRC522::STATUS_OK || responseSize != dataBytes + 2) {
+    return false;
+  }
+  memcpy(out, response, dataBytes);
+  return true;
+}
+
+bool NFCBuildingRegistry::stepComplete(ScanContext& ctx) {
+  uint8_t buildingType = 0;
+  if (ctx.skipNdef) {
+    // The card was removed by someone else since select; it is still active,
+    // so read its type after all instead of registering a wrong one
+    if (!deleteMode && !hasBuilding(ctx.uid)) {
+      ctx.skipNdef = false;
+      MFRC522::PICC_Type piccType = ctx.reader->PICC_GetType(ctx.reader->uid.sak);
+      if (piccType == MFRC522::PICC_TYPE_MIFARE_UL) {
+        ctx.state = ScanState::ReadCapability;
+        return false;
+      }
+      buildingType = resolveBuildingType(ctx);
+    }
+  } else {
+    buildingType = resolveBuildingType(ctx);
+  }
+  
+  if (ctx.ndefMicros) {
+    recordStage(ScanStage::ReadNdef, ctx.ndefMicros);
+  }
+  
+  // Halt the card
+  ctx.reader->PICC_HaltA();
+  ctx.state = ScanState::Idle;
+  
+  bool changed = processCard(ctx, buildingType);
+  processedCards++;
+  // Presence tracking follows one card per reader: further cards of a stack
+  // read by scanAllCards() do not replace the tracked one
+  if (presenceTracking && !ctx.present) {
+    markPresent(ctx);
+  }
+  return changed;
+}
+
+void NFCBuildingRegistry::stepProbeWake(ScanContext& ctx) {
+  byte atqa[2];
+  byte atqaSize = sizeof(atqa);
+  // WUPA also wakes halted cards, unlike the REQA used for new-card detection
+  if (ctx.reader->PICC_WakeupA(atqa, &atqaSize) == MFRC522::STATUS_OK) {
+    ctx.state = ScanState::ProbeSelect;
+    return;
+  }
+  probeMissed(ctx);
+}
+
+void NFCBuildingRegistry::stepProbeSelect(ScanContext& ctx) {
+  MFRC522* reader = ctx.reader;
+  // SELECT by the tracked UID, no anticollision: the WUPA woke every halted
+  // card on the reader, and anticollision would pick whichever card of a
+  // stack wins the bit collision. Only the tracked card answers this.
+  reader->uid.size = ctx.presentUid.len;
+  memcpy(reader->uid.uidByte, ctx.presentUid.bytes, ctx.presentUid.len);
+  if (reader->PICC_Select(&reader->uid, static_cast<byte>(ctx.presentUid.len * 8)) != MFRC522::STATUS_OK) {
+    // Gone (another card may have taken its place; it is detected once
+    // the tracked one counts as absent) or a garbled answer
+    probeMissed(ctx);
+    return;
+  }
+  
+  ctx.lastResponse = millis();
+  ctx.nextProbe = ctx.lastResponse + presenceProbeIntervalMs;
+  if (expiryTtlMs) {
+    // A resting card is still being seen; keep it from expiring
+    DbWriteLock lock(*this);
+    BuildingCard* card = findCardLocked(ctx.presentUid);
+    if (card) touchLocked(*card, ctx.lastResponse);
+  }
+  ctx.state = ScanState::Halt;
+}
+
+void NFCBuildingRegistry::probeMissed(ScanContext& ctx) {
+  if (millis() - ctx.lastResponse >= presenceHoldOffMs) {
+    markAbsent(ctx);
+  } else {
+    ctx.nextProbe = millis() + presenceProbeIntervalMs;
+  }
+  ctx.state = ScanState::Idle;
+}
+
+void NFCBuildingRegistry::markPresent(ScanContext& ctx) {
+  if (ctx.present && ctx.presentUid == ctx.uid) {
+    ctx.lastResponse = millis();
+    return;
+  }
+  if (ctx.present) {
+    markAbsent(ctx);
+  }
+  ctx.present = true;
+  ctx.presentUid = ctx.uid;
+  ctx.lastResponse = millis();
+  ctx.nextProbe = ctx.lastResponse + presenceProbeIntervalMs;
+  emitEvent(BuildingEvent::CardEnter, registeredType(ctx.uid), ctx.uid, ctx.readerIndex);
+}
+
+void NFCBuildingRegistry::markAbsent(ScanContext& ctx) {
+  if (!ctx.present) {
+    return;
+  }
+  ctx.present = false;
+  {
+    // The card was last seen at its last answered probe
+    DbWriteLock lock(*this);
+    BuildingCard* card = findCardLocked(ctx.presentUid);
+    if (card) touchLocked(*card, ctx.lastResponse);
+  }
+  emitEvent(BuildingEvent::CardLeave, registeredType(ctx.presentUid), ctx.presentUid, ctx.readerIndex);
+}
+
+uint8_t NFCBuildingRegistry::resolveBuildingType(ScanContext& ctx) {
+  if (ctx.ndefSize == 0) {
+    // If NDEF reading fails, try to use the first byte of UID as building type
+    // This is a fallback method - you might want to implement a different strategy
+    countStat(StatUidFallbacks);
+    return ctx.uid.bytes[0];
+  }
+  
+  // Custom record type 'B' with a single-byte payload holding the building
+  // type, plus the configured card data records, in one walk over the message
+  const uint8_t* typeByte = nullptr;
+  size_t messageEnd = 0;
+  NdefParseStatus status;
+  if (cardDataFieldCount) {
+    memset(&ctx.data, 0, sizeof(ctx.data));
+  }
+  {
+    StageTimer timer(*this, ScanStage::Parse);
+    status = forEachNdefRecord(ctx.ndef, ctx.ndefSize, [&](const NdefRecord& record) {
+      messageEnd = static_cast<size_t>(record.payload + record.payloadLength - ctx.ndef);
+      if (record.typeLength != 1) {
+        return true;
+      }
+      if (record.type[0] == 'B' && !typeByte && record.payloadLength >= 1) {
+        typeByte = record.payload;
+        if (!cardDataFieldCount) return false; // nothing else to collect
+      }
+      for (uint8_t f = 0; f < cardDataFieldCount; f++) {
+        const CardDataField& field = cardDataFields[f];
+        if (record.type[0] == field.recordType && !ctx.data.has(f)) {
+          size_t n = record.payloadLength < field.length ? record.payloadLength : field.length;
+          memcpy(ctx.data.bytes + field.offset, record.payload, n);
+          ctx.data.fields |= static_cast<uint8_t>(1u << f);
+        }
+      }
+      return true;
+    });
+  }
+  // Card data is only trusted from a complete message
+  if (cardDataFieldCount && status == NdefParseStatus::NotFound) {
+    ctx.data.fields |= NFCCardData::kLoaded;
+    ctx.dataValid = true;
+  }
+  if (typeByte) {
+    ctx.typeFromNdef = true;
+    // The cached hash only stands for the tag if everything taken from it is
+    // inside the hashed block (page 3 = CC + the first 12 NDEF bytes)
+    bool cacheable = cardDataFieldCount ? ctx.dataValid && messageEnd <= 12 : typeByte - ctx.ndef < 12;
+    if (!cacheable) {
+      ctx.blockHash = 0;
+    }
+    return *typeByte;
+  }
+  ctx.blockHash = 0;
+  countStat(StatNdefFailures);
+  if (status == NdefParseStatus::Malformed) {
+    NFC_LOGW("NDEF data malformed or truncated; defaulting to building type 0.");
+  } else {
+    NFC_LOGW("NDEF parsed but no building record found; defaulting to 0.");
+  }
+  return 0;
+}
+
+bool NFCBuildingRegistry::processCard(const ScanContext& ctx, uint8_t buildingType) {
+  const CardUid& uid = ctx.uid;
+  const uint8_t readerIndex = ctx.readerIndex;
+  // Process the card based on current mode
+  if (deleteMode) {
+    // Delete mode: remove building if present
+    bool removed = false;
+    uint8_t removedBuildingType = 0;
+    NFCCardData removedData;
+    const NFCCardData* removedDataRef = nullptr;
+    {
+      DbWriteLock lock(*this);
+      size_t pos = findIndexPos(uid);
+      if (pos != kIndexSize) {
+        BuildingCard& card = slots[slotIndex[pos]];
+        removedBuildingType = card.buildingType;
+        if (const NFCCardData* data = cardDataOf(card)) {
+          removedData = *data;
+          removedDataRef = &removedData;
+        }
+        eraseAtLocked(pos);
+        removed = true;
+      }
+    }
+    
+    if (removed) {
+      countStat(StatRemoves);
+      // Call callback after successful removal
+      emitEvent(BuildingEvent::Removed, removedBuildingType, uid, readerIndex, removedDataRef);
+#if NFC_REGISTRY_PERSISTENCE
+      persistChanges();
+#endif
+      NFC_LOGI("Building removed: UID=%s, Type=%u", NFCLogHex(uid).str, (unsigned)removedBuildingType);
+      return true;
+    } else {
+      // Building not found in delete mode - this is normal for multiple scans
+      NFC_LOGD("Building not found for deletion: UID=%s", NFCLogHex(uid).str);
+    }
+  } else {
+    // Add mode: add building if not present, otherwise update last seen timestamp
+    bool added = false;
+    bool full = false;
+    bool rewritten = false;
+    uint8_t previousType = buildingType;
+    uint8_t currentType = buildingType;
+    NFCCardData previousData, currentData; // for the events, copied under the lock
+    const NFCCardData* dataRef = nullptr;
+    {
+      DbWriteLock lock(*this);
+      BuildingCard* card = findOrInsertLocked(uid, buildingType, added);
+      if (!card) {
+        full = true;
+      } else {
+        uint16_t slot = static_cast<uint16_t>(card - slots);
+        NFCCardData* stored = cardDataOf(*card);
+        if (!added) {
+          touchLocked(*card, millis());
+          // A re-read tag that now carries another building record or other
+          // card data was rewritten. Data loaded for the first time (after a
+          // restore or an API add) is just filled in.
+          previousType = card->buildingType;
+          bool typeChanged = ctx.typeFromNdef && previousType != buildingType;
+          bool dataChanged = stored && ctx.dataValid && (stored->fields & NFCCardData::kLoaded) &&
+                             memcmp(stored, &ctx.data, sizeof(NFCCardData)) != 0;
+          if (stored) previousData = *stored;
+          currentType = typeChanged ? buildingType : previousType;
+          if (typeChanged || dataChanged) {
+            rewriteLocked(slot, currentType);
+            rewritten = true;
+          }
+        }
+        if (stored) {
+          if (ctx.dataValid) *stored = ctx.data;
+          currentData = *stored;
+          dataRef = &currentData;
+        }
+        if (!ctx.skipNdef) {
+          slotNdefHash[slot] = ctx.blockHash; // the tag was read, so the cache follows it
+        }
+      }
+    }
+    
+    if (rewritten) {
+      countStat(StatRewrites);
+      emitEvent(BuildingEvent::Removed, previousType, uid, readerIndex, dataRef ? &previousData : nullptr);
+      emitEvent(BuildingEvent::Added, currentType, uid, readerIndex, dataRef);
+#if NFC_REGISTRY_PERSISTENCE
+      persistChanges();
+#endif
+      NFC_LOGI("Building rewritten: UID=%s, Type=%u -> %u", NFCLogHex(uid).str, (unsigned)previousType,
+               (unsigned)currentType);
+      return true;
+    } else if (added) {
+      countStat(StatAdds);
+      emitEvent(BuildingEvent::Added, buildingType, uid, readerIndex, dataRef);
+#if NFC_REGISTRY_PERSISTENCE
+      persistChanges();
+#endif
+      NFC_LOGI("New building added: UID=%s, Type=%u", NFCLogHex(uid).str, (unsigned)buildingType);
+      return true;
+    } else if (full) {
+      NFC_LOGW("Building database full, card ignored: UID=%s", NFCLogHex(uid).str);
+    } else {
+      countStat(StatReTaps);
+      NFC_LOGD("Building already registered: UID=%s", NFCLogHex(uid).str);
+    }
+  }
+  
+  return false;
+}
+
+void NFCBuildingRegistry::emitEvent(BuildingEvent::Type type, uint8_t buildingType, const CardUid& uid,
+                                    uint8_t readerIndex, const NFCCardData* data) {
+  BuildingEvent event = BuildingEvent();
+  event.type = type;
+  event.buildingType = buildingType;
+  event.reader = readerIndex;
+  event.uid = uid;
+  event.timestamp = millis();
+#if NFC_REGISTRY_CARD_DATA_BYTES
+  if (data) event.data = *data;
+#else
+  (void)data;
+#endif
+  
+  if (!isQueueingEvents()) {
+    deliverEvent(event);
+  } else if (!eventQueue.push(event)) {
+    droppedEvents++;
+  }
+}
+
+void NFCBuildingRegistry::deliverEvent(const BuildingEvent& event) {
+  StageTimer timer(*this, ScanStage::Callbacks);
+  switch (event.type) {
+    case BuildingEvent::Added:
+      notifyNewBuilding(event.buildingType, event.uid);
+      break;
+    case BuildingEvent::Removed:
+      notifyDeleteBuilding(event.buildingType, event.uid);
+      break;
+    case BuildingEvent::CardEnter:
+      if (onCardEnterCallback) onCardEnterCallback(event.uid, event.reader);
+      break;
+    case BuildingEvent::CardLeave:
+      if (onCardLeaveCallback) onCardLeaveCallback(event.uid, event.reader);
+      break;
+  }
+  if (onBuildingEventCallback) {
+    onBuildingEventCallback(event);
+  }
+  if (onBuildingEventFn) {
+    onBuildingEventFn(event, onBuildingEventContext);
+  }
+}
+
+void NFCBuildingRegistry::deliverEvents(const BuildingEvent* events, size_t count) {
+  if (onBatchCallback || onBatchFn) {
+    StageTimer timer(*this, ScanStage::Callbacks);
+    if (onBatchCallback) onBatchCallback(events, count);
+    if (onBatchFn) onBatchFn(events, count, onBatchContext);
+    return;
+  }
+  for (size_t i = 0; i < count; i++) {
+    deliverEvent(events[i]);
+  }
+}
+
+bool NFCBuildingRegistry::isQueueingEvents() const {
+#if defined(ESP32)
+  return deferredCallbacks || scannerTask != nullptr;
+#else
+  return deferredCallbacks;
+#endif
+}
+
+bool NFCBuildingRegistry::popEvent(BuildingEvent& event) {
+  return eventQueue.pop(event);
+}
+
+size_t NFCBuildingRegistry::dispatchEvents(size_t maxEvents) {
+  size_t dispatched = 0;
+  BuildingEvent chunk[kDispatchChunk];
+  while (dispatched < maxEvents) {
+    size_t count = 0;
+    while (count < kDispatchChunk && dispatched + count < maxEvents && eventQueue.pop(chunk[count])) {
+      count++;
+    }
+    if (count == 0) {
+      break;
+    }
+    deliverEvents(chunk, count);
+    dispatched += count;
+  }
+  return dispatched;
+}
+
+void NFCBuildingRegistry::setDeferredCallbacks(bool deferred) {
+  deferredCallbacks = deferred;
+}
+
+bool NFCBuildingRegistry::isDeferredCallbacks() const {
+  return deferredCallbacks;
+}
+
+size_t NFCBuildingRegistry::getPendingEventCount() const {
+  return eventQueue.size();
+}
+
+uint32_t NFCBuildingRegistry::getDroppedEventCount() const {
+  return droppedEvents;
+}
+
+void NFCBuildingRegistry::getStats(NFCRegistryStats& out) const {
+  memset(&out, 0, sizeof(out));
+#if NFC_REGISTRY_STATS
+  for (size_t i = 0; i < static_cast<size_t>(ScanStage::Count); i++) {
+    stageStats[i].copyTo(out.stages[i]);
   }
+  logStats.copyTo(out.stages[static_cast<size_t>(ScanStage::Log)]);
+  out.reads = statCounters[StatReads];
+  out.ndefFailures = statCounters[StatNdefFailures];
+  out.uidFallbacks = statCounters[StatUidFallbacks];
+  out.adds = statCounters[StatAdds];
+  out.removes = statCounters[StatRemoves];
+  out.reTaps = statCounters[StatReTaps];
+  out.lockContention = statCounters[StatLockContention];
+  out.hashHits = statCounters[StatHashHits];
+  out.rewrites = statCounters[StatRewrites];
+#endif
 }
 
-NFCBuildingRegistry::~NFCBuildingRegistry() {
-  // Cleanup if needed
+void NFCBuildingRegistry::resetStats() {
+#if NFC_REGISTRY_STATS
+  for (size_t i = 0; i < static_cast<size_t>(ScanStage::Count); i++) {
+    stageStats[i].reset();
+  }
+  logStats.reset();
+  for (size_t i = 0; i < kStatCounterCount; i++) {
+    statCounters[i] = 0;
+  }
+#endif
 }
 
-bool NFCBuildingRegistry::scanForCards() {
-  if (!mfrc522) {
+#if defined(ESP32)
+bool NFCBuildingRegistry::startScannerTask(BaseType_t core, UBaseType_t priority,
+                                           uint32_t stackSize, uint32_t idleDelayMs) {
+  if (readerCount == 0 || scannerTask) {
     return false;
   }
+#if NFC_REGISTRY_LOCK_POLICY == NFC_LOCK_POLICY_NONE
+  // The task would share the building storage with loop() without any locking
+  NFC_LOGE("ERROR: scanner task needs NFC_REGISTRY_LOCK_POLICY other than NONE!");
+  return false;
+#endif
   
-  // Look for new cards
-  if (!mfrc522->PICC_IsNewCardPresent()) {
+  scannerStopRequested = false;
+  scannerIdleDelayMs = idleDelayMs;
+  TaskHandle_t handle = nullptr;
+  BaseType_t created = xTaskCreatePinnedToCore(scannerTaskEntry, "nfc_scan", stackSize,
+                                               this, priority, &handle, core);
+  if (created != pdPASS) {
     return false;
   }
-  
-  // Select one of the cards
-  if (!mfrc522->PICC_ReadCardSerial()) {
-    return false;
+  scannerTask = handle;
+  return true;
+}
+
+void NFCBuildingRegistry::stopScannerTask() {
+  if (!scannerTask) {
+    return;
   }
-  
-  // Get card UID
-  String uid = getCardUID();
-  
-  // Try to read building type from NDEF data
-  std::vector<uint8_t> ndefData;
-  uint8_t buildingType = 0;
-  
-  if (readNDEFData(ndefData)) {
-    buildingType = parseNDEFBuildingType(ndefData);
-    if (buildingType == 0) {
-      // Distinguish between true type 0 and parse failure by checking for 'B' marker manually
-      bool hasMarkerB = false;
-      for (size_t i = 0; i + 4 < ndefData.size(); ++i) {
-        if (ndefData[i] == 'B') { hasMarkerB = true; break; }
-      }
-      if (!hasMarkerB) {
-        Serial.println("NDEF parsed but no building record found; defaulting to 0.");
-      }
-    }
-  } else {
-    // If NDEF reading fails, try to use the first byte of UID as building type
-    // This is a fallback method - you might want to implement a different strategy
-    if (mfrc522->uid.size > 0) {
-      buildingType = mfrc522->uid.uidByte[0] % 256; // Ensure it's 8-bit
-    }
+  scannerStopRequested = true;
+  // The task clears scannerTask right before deleting itself
+  while (scannerTask) {
+    vTaskDelay(pdMS_TO_TICKS(1));
+  }
+}
+
+bool NFCBuildingRegistry::isScannerTaskRunning() const {
+  return scannerTask != nullptr;
+}
+
+void NFCBuildingRegistry::scannerTaskEntry(void* arg) {
+  NFCBuildingRegistry* self = static_cast<NFCBuildingRegistry*>(arg);
+  // Wait at least one tick when idle so lower-priority tasks (and the idle
+  // task's watchdog feed) still get CPU time
+  TickType_t idleTicks = pdMS_TO_TICKS(self->scannerIdleDelayMs);
+  if (idleTicks == 0) {
+    idleTicks = 1;
   }
   
-  // Halt the card
-  mfrc522->PICC_HaltA();
-  
-  // Process the card based on current mode
-  if (deleteMode) {
-    // Delete mode: remove building if present
-      if (hasBuilding(uid)) {
-      uint8_t removedBuildingType = 0;
-      {
-        std::lock_guard<std::mutex> lock(dbMutex);
-        removedBuildingType = buildingDatabase.find(uid)->second.buildingType; 
+  while (!self->scannerStopRequested) {
+    // One step on every reader per sweep; sleep once all of them are idle or
+    // only waiting for the answer to a REQA
+    bool irqWake = false;
+    bool reading = false;
+    TickType_t waitTicks = idleTicks;
+    for (uint8_t i = 0; i < self->readerCount; i++) {
+      self->poll();
+      const ScanContext& ctx = self->scans[i];
+      if (ctx.state != ScanState::Idle && ctx.state != ScanState::Detect) {
+        reading = true;
       }
-      bool removed = removeBuilding(uid);
-      
-      if (removed) {
-        // Call callback after successful removal
-        if (onDeleteBuildingCallback) {
-          onDeleteBuildingCallback(removedBuildingType, uid);
-        }
-        Serial.println("Building removed: UID=" + uid + ", Type=" + String(removedBuildingType));
-        return true;
+      if (ctx.irqPin >= 0) {
+        // Wake for the IRQ, or in time for the reader's next REQA
+        TickType_t requestTicks = pdMS_TO_TICKS(ctx.irqRequestIntervalMs);
+        if (requestTicks == 0) requestTicks = 1;
+        if (requestTicks < waitTicks) waitTicks = requestTicks;
+        irqWake = true;
       }
-    } else {
-      // Building not found in delete mode - this is normal for multiple scans
-      Serial.println("Building not found for deletion: UID=" + uid);
     }
-  } else {
-    // Add mode: add building if not present
-    if (!hasBuilding(uid)) {
-      addBuilding(uid, buildingType);
-      if (onNewBuildingCallback) {
-        onNewBuildingCallback(buildingType, uid);
-      }
-      Serial.println("New building added: UID=" + uid + ", Type=" + String(buildingType));
-      return true;
+    if (reading) {
+      continue;
+    }
+    if (self->isScanInProgress()) {
+      // Only REQAs out: a card answers within a millisecond, the timeout takes 25
+      vTaskDelay(1);
     } else {
-      // Update last seen timestamp
-      {
-        std::lock_guard<std::mutex> lock(dbMutex);
-        auto it = buildingDatabase.find(uid);
-        if (it != buildingDatabase.end()) it->second.lastSeen = millis();
+      if (irqWake) {
+        ulTaskNotifyTake(pdTRUE, waitTicks);
+      } else if (self->lowPowerScanning) {
+        // Sleep through to the next slot; with tickless idle the CPU stays in light sleep
+        self->settleLowPower();
+        TickType_t slotTicks = pdMS_TO_TICKS(self->getTimeToNextScan());
+        vTaskDelay(slotTicks > idleTicks ? slotTicks : idleTicks);
+      } else {
+        vTaskDelay(idleTicks);
       }
-      Serial.println("Building already registered: UID=" + uid);
     }
   }
   
-  return false;
+  self->scannerTask = nullptr;
+  vTaskDelete(nullptr);
+}
+#endif
+
+void NFCBuildingRegistry::notifyNewBuilding(uint8_t buildingType, const CardUid& uid) {
+  if (onNewBuildingUidCallback) {
+    onNewBuildingUidCallback(buildingType, uid);
+  }
+  if (onNewBuildingCallback) {
+    onNewBuildingCallback(buildingType, uid.toString());
+  }
+}
+
+void NFCBuildingRegistry::notifyDeleteBuilding(uint8_t buildingType, const CardUid& uid) {
+  if (onDeleteBuildingUidCallback) {
+    onDeleteBuildingUidCallback(buildingType, uid);
+  }
+  if (onDeleteBuildingCallback) {
+    onDeleteBuildingCallback(buildingType, uid.toString());
+  }
 }
 
 void NFCBuildingRegistry::setDeleteMode(bool enabled) {
   deleteMode = enabled;
-  Serial.println("Delete mode: " + String(enabled ? "ENABLED" : "DISABLED"));
+  NFC_LOGI("Delete mode: %s", enabled ? "ENABLED" : "DISABLED");
 }
 
 bool NFCBuildingRegistry::isDeleteMode() const {
@@ -112,98 +1529,356 @@ bool NFCBuildingRegistry::isDeleteMode() const {
 }
 
 void NFCBuildingRegistry::clearDatabase() {
-  std::lock_guard<std::mutex> lock(dbMutex);
-  buildingDatabase.clear();
-  Serial.println("Building database cleared");
+  {
+    DbWriteLock lock(*this);
+    resetStorageLocked();
+    recordChangeLocked(BuildingChange::Cleared, CardUid(), 0);
+  }
+#if NFC_REGISTRY_PERSISTENCE
+  persistChanges();
+#endif
+  NFC_LOGI("Building database cleared");
 }
 
 size_t NFCBuildingRegistry::getDatabaseSize() const {
-  std::lock_guard<std::mutex> lock(dbMutex);
-  return buildingDatabase.size();
+  return readOptimistic<size_t>([this]() { return buildingCount; });
 }
 
+// The containers below are filled from copies taken under the lock into
+// vectors reserved beforehand: under NFC_LOCK_POLICY_SPINLOCK the lock is a
+// critical section, where the heap must not be used.
+
 std::map<String, BuildingCard> NFCBuildingRegistry::getAllBuildings() const {
-  std::lock_guard<std::mutex> lock(dbMutex);
-  return buildingDatabase; // copy
+  std::map<String, BuildingCard> result;
+  for (const BuildingCard& card : snapshotBuildings()) {
+    result[card.uid.toString()] = card;
+  }
+  return result;
 }
 
-std::vector<BuildingCard> NFCBuildingRegistry::snapshotBuildings() const {
+std::vector<BuildingCard> NFCBuildingRegistry::snapshotBuildings(uint32_t* version) const {
   std::vector<BuildingCard> out;
-  std::lock_guard<std::mutex> lock(dbMutex);
-  out.reserve(buildingDatabase.size());
-  for (const auto &p : buildingDatabase) out.push_back(p.second);
-  return out;
+  for (;;) {
+    out.reserve(getDatabaseSize());
+    NFCLockGuard<NFCRegistryLock> lock(dbMutex);
+    if (buildingCount > out.capacity()) {
+      continue; // cards were added meanwhile
+    }
+    if (version) *version = dbVersion.load(std::memory_order_relaxed);
+    for (size_t i = 0; i < kCapacity; i++) {
+      if (slots[i].uid.len) out.push_back(slots[i]);
+    }
+    return out;
+  }
+}
+
+std::vector<BuildingCard> NFCBuildingRegistry::snapshotBuildingsOfType(uint8_t buildingType,
+                                                                       std::vector<uint16_t>* slotsOut) const {
+  std::vector<BuildingCard> out;
+  for (;;) {
+    const size_t expected = getBuildingCount(buildingType);
+    out.reserve(expected);
+    if (slotsOut) slotsOut->reserve(expected);
+    NFCLockGuard<NFCRegistryLock> lock(dbMutex);
+    if (typeCount[buildingType] > out.capacity() || (slotsOut && typeCount[buildingType] > slotsOut->capacity())) {
+      continue;
+    }
+    for (uint16_t i = typeHead[buildingType]; i != kNoSlot; i = slotNext[i]) {
+      out.push_back(slots[i]);
+      if (slotsOut) slotsOut->push_back(i);
+    }
+    return out;
+  }
 }
 
 std::map<String, BuildingCard*> NFCBuildingRegistry::getBuildingsByType(uint8_t buildingType) {
   std::map<String, BuildingCard*> result;
-  std::lock_guard<std::mutex> lock(dbMutex);
-  for (auto& pair : buildingDatabase) {
-    if (pair.second.buildingType == buildingType) {
-      result[pair.first] = &pair.second;
-    }
+  std::vector<uint16_t> slotList;
+  const std::vector<BuildingCard> cards = snapshotBuildingsOfType(buildingType, &slotList);
+  for (size_t i = 0; i < cards.size(); i++) {
+    result[cards[i].uid.toString()] = &slots[slotList[i]];
   }
   return result;
 }
 
 bool NFCBuildingRegistry::hasBuildingType(uint8_t buildingType) const {
-  std::lock_guard<std::mutex> lock(dbMutex);
-  for (const auto& pair : buildingDatabase) {
-    if (pair.second.buildingType == buildingType) {
-      return true;
-    }
-  }
-  return false;
+  return getBuildingCount(buildingType) > 0;
 }
 
 size_t NFCBuildingRegistry::getBuildingCount(uint8_t buildingType) const {
-  size_t count = 0;
-  std::lock_guard<std::mutex> lock(dbMutex);
-  for (const auto& pair : buildingDatabase) {
-    if (pair.second.buildingType == buildingType) {
-      count++;
-    }
-  }
-  return count;
+  return readOptimistic<size_t>([this, buildingType]() { return typeCount[buildingType]; });
 }
 
 bool NFCBuildingRegistry::addBuilding(const String& uid, uint8_t buildingType) {
-  if (uid.length() == 0) {
+  CardUid key;
+  return CardUid::fromHex(uid.c_str(), key) && addBuilding(key, buildingType);
+}
+
+bool NFCBuildingRegistry::removeBuilding(const String& uid) {
+  CardUid key;
+  return CardUid::fromHex(uid.c_str(), key) && removeBuilding(key);
+}
+
+bool NFCBuildingRegistry::hasBuilding(const String& uid) const {
+  CardUid key;
+  return CardUid::fromHex(uid.c_str(), key) && hasBuilding(key);
+}
+
+BuildingCard* NFCBuildingRegistry::getBuilding(const String& uid) {
+  CardUid key;
+  return CardUid::fromHex(uid.c_str(), key) ? getBuilding(key) : nullptr;
+}
+
+bool NFCBuildingRegistry::addBuilding(const CardUid& uid, uint8_t buildingType) {
+  if (uid.len == 0 || uid.len > NFC_UID_MAX_BYTES) {
     return false;
   }
   
-  std::lock_guard<std::mutex> lock(dbMutex);
-  if (buildingDatabase.find(uid) != buildingDatabase.end()) {
-    // Building already exists, update last seen
-    buildingDatabase[uid].lastSeen = millis();
-    return false;
+  bool added;
+  {
+    DbWriteLock lock(*this);
+    // Adds the building, or fails when the database is full
+    BuildingCard* card = findOrInsertLocked(uid, buildingType, added);
+    if (card && !added) {
+      // Building already exists, update last seen
+      touchLocked(*card, millis());
+    }
   }
+#if NFC_REGISTRY_PERSISTENCE
+  if (added) {
+    persistChanges();
+  }
+#endif
+  return added;
+}
+
+bool NFCBuildingRegistry::removeBuilding(const CardUid& uid) {
+  {
+    DbWriteLock lock(*this);
+    size_t pos = findIndexPos(uid);
+    if (pos == kIndexSize) {
+      return false;
+    }
+    eraseAtLocked(pos);
+  }
+#if NFC_REGISTRY_PERSISTENCE
+  persistChanges();
+#endif
+  return true;
+}
+
+uint32_t NFCBuildingRegistry::getVersion() const {
+  return dbVersion.load(std::memory_order_acquire);
+}
+
+ChangeFeedStatus NFCBuildingRegistry::changesSince(uint32_t sinceVersion, BuildingChange* out,
+                                                   size_t maxCount, size_t& count) const {
+  count = 0;
+  NFCLockGuard<NFCRegistryLock> lock(dbMutex);
+  uint32_t version = dbVersion.load(std::memory_order_relaxed);
+  if (sinceVersion > version || sinceVersion < changeFloor) {
+    return ChangeFeedStatus::ResyncRequired;
+  }
+  for (uint32_t v = sinceVersion + 1; v <= version && count < maxCount; v++) {
+    out[count++] = changeLog[(v - 1) & (kChangeLogSize - 1)];
+  }
+  return sinceVersion + count == version ? ChangeFeedStatus::Complete : ChangeFeedStatus::More;
+}
+
+void NFCBuildingRegistry::recordChangeLocked(BuildingChange::Type type, const CardUid& uid, uint8_t buildingType) {
+  uint32_t version = dbVersion.load(std::memory_order_relaxed) + 1;
+  BuildingChange& change = changeLog[(version - 1) & (kChangeLogSize - 1)];
+  change.version = version;
+  change.type = type;
+  change.buildingType = buildingType;
+  change.uid = uid;
+  if (version - changeFloor > kChangeLogSize) {
+    changeFloor = version - kChangeLogSize; // oldest entry was just overwritten
+  }
+  dbVersion.store(version, std::memory_order_release);
   
-  // Add new building
-  BuildingCard newCard(uid, buildingType);
-  buildingDatabase[uid] = newCard;
+#if NFC_REGISTRY_PERSISTENCE
+  static const uint8_t journalOps[] = {JournalAdd, JournalRemove, JournalClear};
+  journalLocked(journalOps[type], uid, buildingType);
+#endif
+}
+
+size_t NFCBuildingRegistry::addBuildings(const BuildingEntry* entries, size_t count) {
+  return applyBatch(entries, count, nullptr, 0);
+}
+
+size_t NFCBuildingRegistry::removeBuildings(const CardUid* uids, size_t count) {
+  return applyBatch(nullptr, 0, uids, count);
+}
+
+size_t NFCBuildingRegistry::applyDelta(const BuildingEntry* added, size_t addCount,
+                                       const CardUid* removed, size_t removeCount) {
+  return applyBatch(added, addCount, removed, removeCount);
+}
+
+size_t NFCBuildingRegistry::applyBatch(const BuildingEntry* added, size_t addCount,
+                                       const CardUid* removed, size_t removeCount) {
+  std::vector<BuildingEvent> events;
+  events.reserve((added ? addCount : 0) + (removed ? removeCount : 0));
+  BuildingEvent event = BuildingEvent();
+  event.reader = BuildingEvent::NoReader;
+  event.timestamp = millis();
+  size_t ignored = 0;
   
-  return true;
+  {
+    DbWriteLock lock(*this);
+    // Removals first, so a remove + add of the same UID re-registers it
+    for (size_t i = 0; removed && i < removeCount; i++) {
+      size_t pos = findIndexPos(removed[i]);
+      if (pos == kIndexSize) {
+        continue;
+      }
+      event.type = BuildingEvent::Removed;
+      event.buildingType = slots[slotIndex[pos]].buildingType;
+      event.uid = removed[i];
+      eraseAtLocked(pos);
+      events.push_back(event);
+    }
+    for (size_t i = 0; added && i < addCount; i++) {
+      const BuildingEntry& entry = added[i];
+      if (entry.uid.len == 0 || entry.uid.len > NFC_UID_MAX_BYTES) {
+        ignored++;
+        continue;
+      }
+      bool inserted;
+      BuildingCard* card = findOrInsertLocked(entry.uid, entry.buildingType, inserted);
+      if (!card) {
+        ignored++; // database full
+      } else if (!inserted) {
+        touchLocked(*card, event.timestamp);
+      } else {
+        event.type = BuildingEvent::Added;
+        event.buildingType = entry.buildingType;
+        event.uid = entry.uid;
+        events.push_back(event);
+      }
+    }
+  }
+#if NFC_REGISTRY_PERSISTENCE
+  if (!events.empty()) {
+    persistChanges();
+  }
+#endif
+  if (ignored) {
+    NFC_LOGW("Batch update: %u entries invalid or not stored (database full)", (unsigned)ignored);
+  }
+  
+  // Callbacks run after the lock is released, on the caller's thread
+  if (!events.empty()) {
+    deliverEvents(events.data(), events.size());
+  }
+  return events.size();
 }
 
-bool NFCBuildingRegistry::removeBuilding(const String& uid) {
-  std::lock_guard<std::mutex> lock(dbMutex);
-  return buildingDatabase.erase(uid) > 0;   // returns # of nodes erased
+void NFCBuildingRegistry::setOnBatchCallback(BuildingBatchCallback callback) {
+  onBatchCallback = callback;
+}
+
+void NFCBuildingRegistry::setOnBuildingEventCallback(BuildingEventFn callback, void* context) {
+  onBuildingEventFn = callback;
+  onBuildingEventContext = context;
 }
 
+void NFCBuildingRegistry::setOnBatchCallback(BuildingBatchFn callback, void* context) {
+  onBatchFn = callback;
+  onBatchContext = context;
+}
 
-bool NFCBuildingRegistry::hasBuilding(const String& uid) const {
-  std::lock_guard<std::mutex> lock(dbMutex);
-  return buildingDatabase.find(uid) != buildingDatabase.end();
+uint8_t NFCBuildingRegistry::registeredType(const CardUid& uid) const {
+  return readOptimistic<uint8_t>([this, &uid]() {
+    uint16_t slot = findSlot(uid);
+    return slot != kNoSlot ? slots[slot].buildingType : static_cast<uint8_t>(0);
+  });
 }
 
-BuildingCard* NFCBuildingRegistry::getBuilding(const String& uid) {
-  std::lock_guard<std::mutex> lock(dbMutex);
-  auto it = buildingDatabase.find(uid);
-  if (it != buildingDatabase.end()) {
-    return &it->second;
+uint16_t NFCBuildingRegistry::cachedNdefHash(const CardUid& uid) const {
+  return readOptimistic<uint16_t>([this, &uid]() {
+    uint16_t slot = findSlot(uid);
+    return slot != kNoSlot ? slotNdefHash[slot] : static_cast<uint16_t>(0);
+  });
+}
+
+uint16_t NFCBuildingRegistry::hashNdefBlock(const uint8_t* block) {
+  // FNV-1a folded to 16 bits; 0 is reserved for "not cached"
+  uint32_t h = 2166136261u;
+  for (uint8_t i = 0; i < 16; i++) {
+    h = (h ^ block[i]) * 16777619u;
   }
-  return nullptr;
+  uint16_t folded = static_cast<uint16_t>((h >> 16) ^ h);
+  return folded ? folded : 1;
+}
+
+bool NFCBuildingRegistry::isCardDataLoaded(const CardUid& uid) const {
+  return readOptimistic<bool>([this, &uid]() {
+    uint16_t slot = findSlot(uid);
+#if NFC_REGISTRY_CARD_DATA_BYTES
+    return slot != kNoSlot && (slots[slot].data.fields & NFCCardData::kLoaded) != 0;
+#else
+    return slot != kNoSlot;
+#endif
+  });
+}
+
+bool NFCBuildingRegistry::hasBuilding(const CardUid& uid) const {
+  return readOptimistic<bool>([this, &uid]() { return findSlot(uid) != kNoSlot; });
+}
+
+BuildingCard* NFCBuildingRegistry::getBuilding(const CardUid& uid) {
+  NFCLockGuard<NFCRegistryLock> lock(dbMutex);
+  return findCardLocked(uid);
+}
+
+BuildingHandle NFCBuildingRegistry::getBuildingHandle(const CardUid& uid) const {
+  return readOptimistic<BuildingHandle>([this, &uid]() {
+    uint16_t slot = findSlot(uid);
+    return slot != kNoSlot ? BuildingHandle(slot, slotGeneration[slot]) : BuildingHandle();
+  });
+}
+
+BuildingHandle NFCBuildingRegistry::getBuildingHandle(const String& uid) const {
+  CardUid key;
+  return CardUid::fromHex(uid.c_str(), key) ? getBuildingHandle(key) : BuildingHandle();
+}
+
+bool NFCBuildingRegistry::readBuilding(BuildingHandle handle, BuildingCard& out) const {
+  if (handle.slot >= kCapacity) {
+    return false;
+  }
+  BuildingCard card;
+  bool valid = readOptimistic<bool>([this, handle, &card]() {
+    if (slotGeneration[handle.slot] != handle.generation || !slots[handle.slot].uid.len) {
+      return false;
+    }
+    card = slots[handle.slot];
+    return true;
+  });
+  if (valid) {
+    out = card;
+  }
+  return valid;
+}
+
+bool NFCBuildingRegistry::isHandleValid(BuildingHandle handle) const {
+  if (handle.slot >= kCapacity) {
+    return false;
+  }
+  return readOptimistic<bool>([this, handle]() {
+    return slotGeneration[handle.slot] == handle.generation && slots[handle.slot].uid.len != 0;
+  });
+}
+
+size_t NFCBuildingRegistry::getBuildingHandles(uint8_t buildingType, BuildingHandle* out, size_t maxCount) const {
+  NFCLockGuard<NFCRegistryLock> lock(dbMutex);
+  size_t count = 0;
+  for (uint16_t i = typeHead[buildingType]; i != kNoSlot && count < maxCount; i = slotNext[i]) {
+    out[count++] = BuildingHandle(i, slotGeneration[i]);
+  }
+  return count;
 }
 
 void NFCBuildingRegistry::setOnNewBuildingCallback(BuildingEventCallback callback) {
@@ -214,239 +1889,320 @@ void NFCBuildingRegistry::setOnDeleteBuildingCallback(BuildingEventCallback call
   onDeleteBuildingCallback = callback;
 }
 
+void NFCBuildingRegistry::setOnNewBuildingCallback(BuildingUidEventCallback callback) {
+  onNewBuildingUidCallback = callback;
+}
+
+void NFCBuildingRegistry::setOnDeleteBuildingCallback(BuildingUidEventCallback callback) {
+  onDeleteBuildingUidCallback = callback;
+}
+
+void NFCBuildingRegistry::setOnBuildingEventCallback(BuildingEventHandler callback) {
+  onBuildingEventCallback = callback;
+}
+
+void NFCBuildingRegistry::setOnCardEnterCallback(CardPresenceCallback callback) {
+  onCardEnterCallback = callback;
+}
+
+void NFCBuildingRegistry::setOnCardLeaveCallback(CardPresenceCallback callback) {
+  onCardLeaveCallback = callback;
+}
+
 void NFCBuildingRegistry::printDatabase() const {
-  std::lock_guard<std::mutex> lock(dbMutex);
+  // Print from a snapshot so the slow serial output never holds the lock
+  std::vector<BuildingCard> cards = snapshotBuildings();
   Serial.println("=== Building Database ===");
-  Serial.println("Total buildings: " + String(buildingDatabase.size()));
+  Serial.println("Total buildings: " + String(cards.size()));
   
-  for (const auto& pair : buildingDatabase) {
-    const BuildingCard& card = pair.second;
-    Serial.println("UID: " + card.uid + 
+  for (const BuildingCard& card : cards) {
+    Serial.println("UID: " + card.uid.toString() + 
                    " | Type: " + String(card.buildingType) + 
-                   " | First: " + String(card.firstSeen) + 
-                   " | Last: " + String(card.lastSeen));
+                   " | First: " + String(card.firstSeen()) + 
+                   " | Last: " + String(card.lastSeen()));
   }
   Serial.println("========================");
 }
 
 void NFCBuildingRegistry::printBuildingsByType(uint8_t buildingType) const {
-  std::lock_guard<std::mutex> lock(dbMutex);
+  std::vector<BuildingCard> cards = snapshotBuildingsOfType(buildingType, nullptr);
   Serial.println("=== Buildings of Type " + String(buildingType) + " ===");
   
-  int count = 0;
-  for (const auto& pair : buildingDatabase) {
-    if (pair.second.buildingType == buildingType) {
-      const BuildingCard& card = pair.second;
-      Serial.println("UID: " + card.uid + 
-                     " | First: " + String(card.firstSeen) + 
-                     " | Last: " + String(card.lastSeen));
-      count++;
-    }
+  for (const BuildingCard& card : cards) {
+    Serial.println("UID: " + card.uid.toString() + 
+                   " | First: " + String(card.firstSeen()) + 
+                   " | Last: " + String(card.lastSeen()));
   }
   
-  Serial.println("Total: " + String(count) + " buildings");
+  Serial.println("Total: " + String(cards.size()) + " buildings");
   Serial.println("============================");
 }
 
-String NFCBuildingRegistry::getCardUID() {
-  if (!mfrc522) {
-    return "";
+size_t NFCBuildingRegistry::hashKey(const CardUid& key) {
+  // FNV-1a over the raw UID bytes
+  uint32_t h = 2166136261u;
+  for (uint8_t i = 0; i < key.len; i++) {
+    h = (h ^ key.bytes[i]) * 16777619u;
   }
-  
-  return uidToString(mfrc522->uid.uidByte, mfrc522->uid.size);
+  return h & (kIndexSize - 1);
 }
 
-bool NFCBuildingRegistry::readNDEFData(std::vector<uint8_t>& ndefData) {
-  if (!mfrc522) {
-    return false;
+size_t NFCBuildingRegistry::findIndexPos(const CardUid& key) const {
+  size_t pos = hashKey(key);
+  while (slotIndex[pos] != kNoSlot) {
+    if (slots[slotIndex[pos]].uid == key) {
+      return pos;
+    }
+    pos = (pos + 1) & (kIndexSize - 1);
   }
-  
-  // Check if it's an NTAG or similar NFC Forum Type 2 tag
-  MFRC522::PICC_Type piccType = mfrc522->PICC_GetType(mfrc522->uid.sak);
-  if (piccType != MFRC522::PICC_TYPE_MIFARE_UL) {
-    return false; // Not an NFC Forum Type 2 tag
+  return kIndexSize;
+}
+
+uint16_t NFCBuildingRegistry::findSlot(const CardUid& key) const {
+  size_t pos = hashKey(key);
+  for (size_t probes = 0; probes < kIndexSize; probes++) {
+    uint16_t slot = slotIndex[pos];
+    if (slot >= kCapacity) {
+      break; // kNoSlot
+    }
+    if (slots[slot].uid == key) {
+      return slot;
+    }
+    pos = (pos + 1) & (kIndexSize - 1);
   }
+  return kNoSlot;
+}
+
+BuildingCard* NFCBuildingRegistry::findCardLocked(const CardUid& key) {
+  size_t pos = findIndexPos(key);
+  return pos != kIndexSize ? &slots[slotIndex[pos]] : nullptr;
+}
+
+const BuildingCard* NFCBuildingRegistry::findCardLocked(const CardUid& key) const {
+  size_t pos = findIndexPos(key);
+  return pos != kIndexSize ? &slots[slotIndex[pos]] : nullptr;
+}
+
+BuildingCard* NFCBuildingRegistry::findOrInsertLocked(const CardUid& key, uint8_t buildingType, bool& inserted) {
+  inserted = false;
   
-  // Working buffer for MFRC522::MIFARE_Read (16 bytes of data + 2 CRC bytes)
-  std::vector<byte> buffer(18);
-  byte size = static_cast<byte>(buffer.size());
-  MFRC522::StatusCode status;
-  
-  // Read capability container (CC) at page 3
-  status = mfrc522->MIFARE_Read(3, buffer.data(), &size);
-  if (status != MFRC522::STATUS_OK) {
-    return false;
+  // One probe sequence: it either hits the key or ends at the empty
+  // position where the key belongs
+  size_t pos = hashKey(key);
+  while (slotIndex[pos] != kNoSlot) {
+    if (slots[slotIndex[pos]].uid == key) {
+      return &slots[slotIndex[pos]];
+    }
+    pos = (pos + 1) & (kIndexSize - 1);
   }
-  
-  // Check if NDEF is present (magic number 0xE1)
-  if (buffer[0] != 0xE1) {
-    return false;
+  if (freeHead == kNoSlot) {
+    return nullptr; // database full
   }
   
-  // Read NDEF data starting from page 4
-  ndefData.clear();
-  ndefData.reserve(64); // common small NDEF sizes; auto-expands if needed
+  uint16_t slot = freeHead;
+  freeHead = slotNext[slot];
+  slotIndex[pos] = slot;
+  inserted = true;
   
-  // Read multiple pages to get the full NDEF message
-  for (int page = 4; page < 20; page += 4) {
-    size = static_cast<byte>(buffer.size());
-    status = mfrc522->MIFARE_Read(page, buffer.data(), &size);
-    if (status != MFRC522::STATUS_OK) {
+  BuildingCard& card = slots[slot];
+  card = BuildingCard(key, buildingType);
+  slotNdefHash[slot] = 0;
+  linkTypeLocked(slot);
+  linkLruLocked(slot);
+  buildingCount++;
+  recordChangeLocked(BuildingChange::Added, key, buildingType);
+  return &card;
+}
+
+void NFCBuildingRegistry::eraseAtLocked(size_t indexPos) {
+  const size_t mask = kIndexSize - 1;
+  uint16_t slot = slotIndex[indexPos];
+  
+  // Backward-shift deletion: pull later entries of the probe run into the
+  // hole so lookups never need tombstones.
+  size_t hole = indexPos;
+  size_t pos = indexPos;
+  for (;;) {
+    pos = (pos + 1) & mask;
+    if (slotIndex[pos] == kNoSlot) {
       break;
     }
-    
-    // Copy 16 bytes of data to NDEF buffer (skip last 2 CRC bytes)
-    for (int i = 0; i < 16; i++) {
-      ndefData.push_back(buffer[i]);
-    }
-    
-    // If we encounter terminator TLV (0xFE), stop reading
-    for (int i = 0; i < 16; i++) {
-      if (buffer[i] == 0xFE) {
-        return !ndefData.empty();
-      }
+    size_t home = hashKey(slots[slotIndex[pos]].uid);
+    // Move the entry only if its home position is not within (hole, pos]
+    if (((pos - home) & mask) >= ((pos - hole) & mask)) {
+      slotIndex[hole] = slotIndex[pos];
+      hole = pos;
     }
   }
+  slotIndex[hole] = kNoSlot;
   
-  return !ndefData.empty();
+  recordChangeLocked(BuildingChange::Removed, slots[slot].uid, slots[slot].buildingType);
+  unlinkTypeLocked(slot);
+  unlinkLruLocked(slot);
+  slotGeneration[slot]++;
+  slots[slot] = BuildingCard();
+  slotNext[slot] = freeHead;
+  freeHead = slot;
+  buildingCount--;
 }
 
-uint8_t NFCBuildingRegistry::parseNDEFBuildingType(const std::vector<uint8_t>& data) {
-  // Robust parser for a single-byte payload record with type 'B'
-  if (data.empty()) return 0;
+void NFCBuildingRegistry::resetStorageLocked() {
+  for (size_t i = 0; i < kIndexSize; i++) {
+    slotIndex[i] = kNoSlot;
+  }
+  for (size_t i = 0; i < kCapacity; i++) {
+    slots[i] = BuildingCard();
+    slotGeneration[i]++; // invalidates handles on clearDatabase()
+    slotNext[i] = static_cast<uint16_t>(i + 1 < kCapacity ? i + 1 : kNoSlot);
+    slotPrev[i] = kNoSlot;
+    slotNdefHash[i] = 0;
+    lruPrev[i] = kNoSlot;
+    lruNext[i] = kNoSlot;
+  }
+  lruHead = kNoSlot;
+  lruTail = kNoSlot;
+  for (size_t t = 0; t < 256; t++) {
+    typeHead[t] = kNoSlot;
+    typeCount[t] = 0;
+  }
+  freeHead = 0;
+  buildingCount = 0;
+}
 
-  auto within = [&](size_t idx) { return idx < data.size(); };
+void NFCBuildingRegistry::linkTypeLocked(uint16_t slot) {
+  uint8_t type = slots[slot].buildingType;
+  slotPrev[slot] = kNoSlot;
+  slotNext[slot] = typeHead[type];
+  if (typeHead[type] != kNoSlot) {
+    slotPrev[typeHead[type]] = slot;
+  }
+  typeHead[type] = slot;
+  typeCount[type]++;
+}
 
-  size_t i = 0;
-  while (i < data.size()) {
-    uint8_t tlvType = data[i];
+void NFCBuildingRegistry::unlinkTypeLocked(uint16_t slot) {
+  uint8_t type = slots[slot].buildingType;
+  if (slotPrev[slot] != kNoSlot) {
+    slotNext[slotPrev[slot]] = slotNext[slot];
+  } else {
+    typeHead[type] = slotNext[slot];
+  }
+  if (slotNext[slot] != kNoSlot) {
+    slotPrev[slotNext[slot]] = slotPrev[slot];
+  }
+  slotPrev[slot] = kNoSlot;
+  typeCount[type]--;
+}
 
-    if (tlvType == 0x00) { // NULL TLV (padding)
-      i += 1;
-      continue;
-    }
-    if (tlvType == 0xFE) { // Terminator TLV – stop
-      break;
-    }
+void NFCBuildingRegistry::linkLruLocked(uint16_t slot) {
+  lruPrev[slot] = lruTail;
+  lruNext[slot] = kNoSlot;
+  if (lruTail != kNoSlot) {
+    lruNext[lruTail] = slot;
+  } else {
+    lruHead = slot;
+  }
+  lruTail = slot;
+}
 
-    if (tlvType == 0x03) { // NDEF Message TLV
-      // Read length (short or extended)
-      if (!within(i + 1)) return 0; // malformed
-      size_t lenFieldBytes = 1;
-      size_t ndefLen = data[i + 1];
-      if (ndefLen == 0xFF) { // extended length (2 bytes)
-        if (!within(i + 3)) return 0; // malformed
-        ndefLen = (static_cast<size_t>(data[i + 2]) << 8) | data[i + 3];
-        lenFieldBytes = 3;
-      }
+void NFCBuildingRegistry::unlinkLruLocked(uint16_t slot) {
+  if (lruPrev[slot] != kNoSlot) {
+    lruNext[lruPrev[slot]] = lruNext[slot];
+  } else {
+    lruHead = lruNext[slot];
+  }
+  if (lruNext[slot] != kNoSlot) {
+    lruPrev[lruNext[slot]] = lruPrev[slot];
+  } else {
+    lruTail = lruPrev[slot];
+  }
+  lruPrev[slot] = kNoSlot;
+  lruNext[slot] = kNoSlot;
+}
 
-      size_t msgStart = i + 1 + lenFieldBytes; // first byte of first record
-      size_t msgEnd = msgStart + ndefLen;      // one past last byte of message
-      if (msgStart >= data.size()) return 0;   // malformed
-      if (msgEnd > data.size()) {              // Truncated read – clamp
-        msgEnd = data.size();
+void NFCBuildingRegistry::sortLruLocked() {
+  // Oldest first by age, which is wrap-safe in the timestamp domain. Bottom-up
+  // merge sort of the list through lruNext, so nothing is allocated under the lock.
+  const NFCTimestamp now = nfcTimestampNow();
+  auto age = [this, now](uint16_t slot) {
+    return static_cast<NFCTimestamp>(now - slots[slot].lastSeenStamp);
+  };
+  uint16_t head = lruHead;
+  for (size_t width = 1;; width *= 2) {
+    uint16_t merged = kNoSlot;
+    uint16_t tail = kNoSlot;
+    size_t merges = 0;
+    uint16_t left = head;
+    while (left != kNoSlot) {
+      // Merge the runs [left, +width) and [right, +width)
+      merges++;
+      uint16_t right = left;
+      size_t leftSize = 0;
+      while (leftSize < width && right != kNoSlot) {
+        right = lruNext[right];
+        leftSize++;
       }
-
-      size_t p = msgStart;
-      while (p < msgEnd) {
-        if (!within(p)) break;
-        uint8_t header = data[p++];
-        bool shortRecord = (header & 0x10) != 0; // SR bit
-        bool hasId       = (header & 0x08) != 0; // IL bit
-        uint8_t typeLen;
-        size_t payloadLen = 0;
-
-        if (!within(p)) break;
-        typeLen = data[p++];
-
-        if (shortRecord) {
-          if (!within(p)) break;
-          payloadLen = data[p++];
+      size_t rightSize = width;
+      while (leftSize > 0 || (rightSize > 0 && right != kNoSlot)) {
+        uint16_t next;
+        if (leftSize > 0 && (rightSize == 0 || right == kNoSlot || age(left) >= age(right))) {
+          next = left;
+          left = lruNext[left];
+          leftSize--;
         } else {
-          if (p + 4 > msgEnd) break; // not supporting large records fully
-          payloadLen = (static_cast<size_t>(data[p]) << 24) |
-                       (static_cast<size_t>(data[p + 1]) << 16) |
-                       (static_cast<size_t>(data[p + 2]) << 8)  |
-                       (static_cast<size_t>(data[p + 3]));
-          p += 4;
+          next = right;
+          right = lruNext[right];
+          rightSize--;
         }
-
-        uint8_t idLen = 0;
-        if (hasId) {
-          if (!within(p)) break;
-            idLen = data[p++];
-        }
-
-        // Bounds for type / id / payload
-        if (p + typeLen > msgEnd) break;
-        const size_t typePos = p;
-        p += typeLen;
-
-        if (p + idLen > msgEnd) break;
-        const size_t idPos = p;
-        (void)idPos; // unused, but kept for clarity
-        p += idLen;
-
-        if (p + payloadLen > msgEnd) break; // truncated
-
-        // Check for our custom record type 'B'
-        if (typeLen == 1 && data[typePos] == 'B') {
-          if (payloadLen >= 1) {
-            return data[p]; // First (and only) byte is the building type
-          } else {
-            // Empty payload for 'B' – treat as not found
-            return 0; 
-          }
+        if (tail == kNoSlot) {
+          merged = next;
+        } else {
+          lruNext[tail] = next;
         }
-
-        // Skip payload
-        p += payloadLen;
-
-        // If ME (Message End) bit set, stop parsing further records
-        if (header & 0x40) break;
+        tail = next;
       }
-
-      // Finished NDEF message without finding 'B'
-      break; // Stop scanning TLVs
+      left = right;
     }
-
-    // Unsupported TLV – need to know its length to skip. TLVs with a length byte: 0x01,0x02,0x04.. etc.
-    // For robustness, try to read a length; if impossible, abort.
-    if (!within(i + 1)) break;
-    uint8_t tlvLen = data[i + 1];
-    if (tlvLen == 0xFF) { // extended format – need 2 more bytes
-      if (!within(i + 3)) break;
-      tlvLen = 0; // We don't actually need the true value for skipping safely here.
-      i += 4;     // type + 0xFF + two length bytes (value skipped blindly)
-    } else {
-      i += 2 + tlvLen; // type + length + value
+    if (tail != kNoSlot) {
+      lruNext[tail] = kNoSlot;
+    }
+    head = merged;
+    if (merges <= 1) {
+      break;
     }
   }
+  // Back links and tail
+  lruHead = head;
+  lruTail = kNoSlot;
+  for (uint16_t slot = head; slot != kNoSlot; slot = lruNext[slot]) {
+    lruPrev[slot] = lruTail;
+    lruTail = slot;
+  }
+}
 
-  // Fallback heuristic: raw short record pattern scan (flags, typeLen=1, payloadLen>=1, 'B', value)
-  for (size_t k = 0; k + 4 < data.size(); ++k) {
-    uint8_t flags = data[k];
-    if ((flags & 0x10) == 0) continue; // Need SR
-    uint8_t tLen = data[k + 1];
-    uint8_t pLen = data[k + 2];
-    if (tLen == 1 && pLen >= 1 && data[k + 3] == 'B') {
-      return data[k + 4];
-    }
+void NFCBuildingRegistry::touchLocked(BuildingCard& card, unsigned long ms) {
+  card.setLastSeen(ms);
+  uint16_t slot = static_cast<uint16_t>(&card - slots);
+  if (slot != lruTail) {
+    unlinkLruLocked(slot);
+    linkLruLocked(slot);
   }
+}
 
-  return 0; // Not found
+void NFCBuildingRegistry::rewriteLocked(uint16_t slot, uint8_t buildingType) {
+  BuildingCard& card = slots[slot];
+  recordChangeLocked(BuildingChange::Removed, card.uid, card.buildingType);
+  if (card.buildingType != buildingType) {
+    unlinkTypeLocked(slot);
+    card.buildingType = buildingType;
+    linkTypeLocked(slot);
+  }
+  recordChangeLocked(BuildingChange::Added, card.uid, buildingType);
 }
 
 String NFCBuildingRegistry::uidToString(byte* uid, byte uidSize) {
-  String result = "";
-  for (byte i = 0; i < uidSize; i++) {
-    if (uid[i] < 0x10) {
-      result += "0";
-    }
-    result += String(uid[i], HEX);
-  }
-  result.toUpperCase();
-  return result;
+  CardUid key;
+  return CardUid::fromBytes(uid, uidSize, key) ? key.toString() : String("");
 }
 
 void NFCBuildingRegistry::printUID(byte* uid, byte uidSize) {
@@ -462,3 +2218,15 @@ void NFCBuildingRegistry::printUID(byte* uid, byte uidSize) {
   }
   Serial.println();
 }
+
+void NFCBuildingRegistry::printUID(const CardUid& uid) {
+  printUID(const_cast<byte*>(uid.bytes), uid.len);
+}
+
+void NFCBuildingRegistry::setLogOutput(Print* output) {
+  logOutput = output;
+}
+
+Print* NFCBuildingRegistry::getLogOutput() {
+  return logOutput;
+}
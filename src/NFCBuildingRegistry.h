@@ -13,52 +13,818 @@
   #include <map>
   #include <functional>
   #include <vector>
-  #include <mutex>
+  #include <freertos/FreeRTOS.h>
+  #include <freertos/task.h>
 #else
   #error "This library only supports ESP8266 and ESP32"
 #endif
 
-// Structure to represent a building card
+#include <atomic>
+#include "NFCEventRing.h"
+#include "NFCRegistryStats.h"
+
+// Optional flash persistence through the Arduino fs::FS API (LittleFS etc.)
+#ifndef NFC_REGISTRY_PERSISTENCE
+  #define NFC_REGISTRY_PERSISTENCE 1
+#endif
+#if NFC_REGISTRY_PERSISTENCE
+  #include <FS.h>
+#endif
+
+// Maximum number of cards the registry can hold. Storage is allocated inline
+// in the registry object, so this directly sets its RAM footprint.
+#ifndef NFC_REGISTRY_MAX_CARDS
+  #define NFC_REGISTRY_MAX_CARDS 256
+#endif
+
+// Maximum number of MFRC522 readers feeding one registry
+#ifndef NFC_REGISTRY_MAX_READERS
+  #define NFC_REGISTRY_MAX_READERS 8
+#endif
+
+// Largest NDEF area (bytes from page 4) read per tap. Reads are sized to the
+// NDEF TLV length, so this only caps unusually large messages.
+#ifndef NFC_REGISTRY_NDEF_MAX_BYTES
+  #define NFC_REGISTRY_NDEF_MAX_BYTES 64
+#endif
+
+// Per-card data area filled from extra NDEF records (setCardDataFields()),
+// e.g. level, owner or capacity. 0 leaves the feature out.
+#ifndef NFC_REGISTRY_CARD_DATA_BYTES
+  #define NFC_REGISTRY_CARD_DATA_BYTES 0
+#endif
+
+// Number of pending add/remove events buffered for dispatchEvents() (power of two)
+#ifndef NFC_REGISTRY_EVENT_QUEUE_SIZE
+  #define NFC_REGISTRY_EVENT_QUEUE_SIZE 32
+#endif
+
+// Number of recent changes kept for changesSince() (power of two)
+#ifndef NFC_REGISTRY_CHANGELOG_SIZE
+  #define NFC_REGISTRY_CHANGELOG_SIZE 64
+#endif
+
+// Scan pipeline statistics (getStats()): per-stage micros() histograms and
+// counters. Off by default; costs two micros() calls per instrumented stage.
+#ifndef NFC_REGISTRY_STATS
+  #define NFC_REGISTRY_STATS 0
+#endif
+
+// Journal records appended between snapshot rewrites. Bounds both the journal
+// file size and how often the snapshot is rewritten (flash wear).
+#ifndef NFC_REGISTRY_JOURNAL_MAX_RECORDS
+  #define NFC_REGISTRY_JOURNAL_MAX_RECORDS 128
+#endif
+
+// Diagnostic log levels. NFC_REGISTRY_LOG_LEVEL must be set through build
+// flags (e.g. -DNFC_REGISTRY_LOG_LEVEL=NFC_LOG_LEVEL_INFO) so the library's
+// .cpp sees it; messages above the chosen level are compiled out entirely.
+#define NFC_LOG_LEVEL_NONE  0
+#define NFC_LOG_LEVEL_ERROR 1
+#define NFC_LOG_LEVEL_WARN  2
+#define NFC_LOG_LEVEL_INFO  3
+#define NFC_LOG_LEVEL_DEBUG 4
+
+#ifndef NFC_REGISTRY_LOG_LEVEL
+  #define NFC_REGISTRY_LOG_LEVEL NFC_LOG_LEVEL_NONE
+#endif
+
+// Locking of the building storage, set through build flags like the log level:
+//   NFC_LOCK_POLICY_NONE     no locking; the registry is used from one thread
+//                            only (default on ESP8266)
+//   NFC_LOCK_POLICY_SPINLOCK ESP32 portMUX critical sections; requires
+//                            NFC_REGISTRY_PERSISTENCE=0
+//   NFC_LOCK_POLICY_MUTEX    std::mutex (default on ESP32)
+#define NFC_LOCK_POLICY_NONE     0
+#define NFC_LOCK_POLICY_SPINLOCK 1
+#define NFC_LOCK_POLICY_MUTEX    2
+
+#ifndef NFC_REGISTRY_LOCK_POLICY
+  #if defined(ESP32)
+    #define NFC_REGISTRY_LOCK_POLICY NFC_LOCK_POLICY_MUTEX
+  #else
+    #define NFC_REGISTRY_LOCK_POLICY NFC_LOCK_POLICY_NONE
+  #endif
+#endif
+#if NFC_REGISTRY_LOCK_POLICY != NFC_LOCK_POLICY_NONE && !defined(ESP32)
+  #error "NFC_REGISTRY_LOCK_POLICY other than NFC_LOCK_POLICY_NONE requires ESP32"
+#endif
+#if NFC_REGISTRY_LOCK_POLICY == NFC_LOCK_POLICY_SPINLOCK && NFC_REGISTRY_PERSISTENCE
+  // Snapshots are written with the storage locked; interrupts must stay enabled for flash I/O
+  #error "NFC_LOCK_POLICY_SPINLOCK cannot be combined with NFC_REGISTRY_PERSISTENCE"
+#endif
+#include "NFCRegistryLock.h"
+
+// Card timestamps are stored as NFC_REGISTRY_TIMESTAMP_BITS-wide counters of
+// NFC_REGISTRY_TIMESTAMP_RESOLUTION_MS. The default 16 bits at 1 s keeps a card
+// at 16 bytes and covers ages up to ~18 h; older timestamps wrap around.
+// 32 bits at 1 ms matches millis() exactly (20 bytes per card).
+#ifndef NFC_REGISTRY_TIMESTAMP_BITS
+  #define NFC_REGISTRY_TIMESTAMP_BITS 16
+#endif
+#ifndef NFC_REGISTRY_TIMESTAMP_RESOLUTION_MS
+  #if NFC_REGISTRY_TIMESTAMP_BITS == 32
+    #define NFC_REGISTRY_TIMESTAMP_RESOLUTION_MS 1
+  #else
+    #define NFC_REGISTRY_TIMESTAMP_RESOLUTION_MS 1000
+  #endif
+#endif
+
+// Upper bound for the registry's inline card storage, checked at compile time
+// against NFC_REGISTRY_MAX_CARDS
+#ifndef NFC_REGISTRY_MAX_STORAGE_BYTES
+  #if defined(ESP8266)
+    #define NFC_REGISTRY_MAX_STORAGE_BYTES 32768
+  #else
+    #define NFC_REGISTRY_MAX_STORAGE_BYTES 131072
+  #endif
+#endif
+
+// Longest UID defined by ISO 14443-3 (triple size) and its hex string length
+#define NFC_UID_MAX_BYTES 10
+#define NFC_UID_HEX_LEN   (NFC_UID_MAX_BYTES * 2)
+
+// Binary card UID (4, 7 or 10 bytes). Plain POD - safe to copy and compare
+// without touching the heap.
+struct CardUid {
+  uint8_t len;                      // number of valid bytes, 0 = empty
+  uint8_t bytes[NFC_UID_MAX_BYTES];
+  
+  bool operator==(const CardUid& other) const {
+    return len == other.len && memcmp(bytes, other.bytes, len) == 0;
+  }
+  bool operator!=(const CardUid& other) const { return !(*this == other); }
+  
+  // Writes the UID as upper-case hex into a caller-supplied buffer. Returns out.
+  char* toHex(char (&out)[NFC_UID_HEX_LEN + 1]) const;
+  // Heap-allocating convenience wrapper around toHex()
+  String toString() const;
+  
+  // Builds a UID from raw bytes / a hex string. Return false on invalid input.
+  static bool fromBytes(const uint8_t* data, uint8_t size, CardUid& out);
+  static bool fromHex(const char* hex, CardUid& out);
+};
+
+#if NFC_REGISTRY_TIMESTAMP_BITS == 16
+  typedef uint16_t NFCTimestamp;
+#elif NFC_REGISTRY_TIMESTAMP_BITS == 32
+  typedef uint32_t NFCTimestamp;
+#else
+  #error "NFC_REGISTRY_TIMESTAMP_BITS must be 16 or 32"
+#endif
+
+// Current time in NFC_REGISTRY_TIMESTAMP_RESOLUTION_MS ticks. A running count
+// advanced by millis() deltas, so it only wraps at the timestamp width
+// (millis() / resolution would jump when millis() wraps, 2^32 not being a
+// multiple of the resolution times 2^bits). Scans, tick() and lastSeen()
+// advance it; it needs a call at least once per millis() period (~49 days).
+NFCTimestamp nfcTimestampNow();
+
+// A millis() time within the last ~24 days (or slightly ahead) as a timestamp
+NFCTimestamp nfcTimestamp(unsigned long ms);
+
+// Converts a stored timestamp back to the millis() time base. Exact for 32-bit
+// millisecond timestamps, otherwise the start of the tick.
+unsigned long nfcTimestampToMillis(NFCTimestamp stamp);
+
+// Maps one NDEF record type to a region of the card data area. The payload
+// is copied to data.bytes[offset..offset+length), truncated to length and
+// zero padded.
+struct CardDataField {
+  uint8_t recordType; // one-byte NDEF record type, like 'B' for the building type
+  uint8_t offset;
+  uint8_t length;
+};
+
+// Extension area of a card, read from the tag in the same pass as its type
+struct NFCCardData {
+  static constexpr uint8_t kMaxFields = 7;
+  static constexpr uint8_t kLoaded = 0x80; // read from the tag (not just restored or added by API)
+  
+  // NFC_REGISTRY_CARD_DATA_BYTES rounded up so BuildingCard needs no padding
+  static constexpr size_t kSize =
+      (NFC_REGISTRY_CARD_DATA_BYTES + sizeof(NFCTimestamp)) / sizeof(NFCTimestamp) * sizeof(NFCTimestamp) - 1;
+  
+  uint8_t fields; // bit i: field i of setCardDataFields() was on the tag; plus kLoaded
+  uint8_t bytes[kSize];
+  
+  bool has(uint8_t field) const { return (fields >> field) & 1; }
+};
+
+// Structure to represent a building card. Kept to 16 bytes with the default
+// 16-bit timestamps, so the slot array is one contiguous block of compact records.
 struct BuildingCard {
-  String uid;           // Card UID as hex string
-  uint8_t buildingType; // Building type (8-bit)
-  unsigned long firstSeen; // Timestamp when first registered
-  unsigned long lastSeen;  // Timestamp when last seen
-  
-  BuildingCard() : uid(""), buildingType(0), firstSeen(0), lastSeen(0) {}
-  BuildingCard(const String& cardUid, uint8_t type) 
-    : uid(cardUid), buildingType(type), firstSeen(millis()), lastSeen(millis()) {}
+  CardUid uid;                 // Card UID (raw bytes, stored inline)
+  uint8_t buildingType;        // Building type (8-bit)
+  NFCTimestamp firstSeenStamp; // when first registered (see nfcTimestampNow())
+  NFCTimestamp lastSeenStamp;  // when last seen
+#if NFC_REGISTRY_CARD_DATA_BYTES
+  NFCCardData data;            // extra NDEF records (NFC_REGISTRY_CARD_DATA_BYTES)
+#endif
+  
+  BuildingCard() : uid(), buildingType(0), firstSeenStamp(0), lastSeenStamp(0) { clearData(); }
+  BuildingCard(const CardUid& cardUid, uint8_t type) 
+    : uid(cardUid), buildingType(type), firstSeenStamp(nfcTimestampNow()), lastSeenStamp(firstSeenStamp) {
+    clearData();
+  }
+  
+  void clearData() {
+#if NFC_REGISTRY_CARD_DATA_BYTES
+    memset(&data, 0, sizeof(data));
+#endif
+  }
+  
+  // Timestamps in the millis() time base
+  unsigned long firstSeen() const { return nfcTimestampToMillis(firstSeenStamp); }
+  unsigned long lastSeen() const { return nfcTimestampToMillis(lastSeenStamp); }
+  void setFirstSeen(unsigned long ms) { firstSeenStamp = nfcTimestamp(ms); }
+  void setLastSeen(unsigned long ms) { lastSeenStamp = nfcTimestamp(ms); }
 };
+static_assert(sizeof(BuildingCard) == sizeof(CardUid) + 1 + 2 * sizeof(NFCTimestamp) +
+                  (NFC_REGISTRY_CARD_DATA_BYTES ? sizeof(NFCCardData) : 0),
+              "BuildingCard must not contain padding");
+
+// Stable reference to a stored card: its slot plus the slot's generation at
+// the time the handle was taken. The generation changes whenever the slot is
+// freed, so a handle to a removed (or removed and reused) card is detected as
+// stale instead of silently reading another card.
+struct BuildingHandle {
+  uint16_t slot;       // 0xFFFF = no card
+  uint16_t generation;
+  
+  BuildingHandle() : slot(0xFFFF), generation(0) {}
+  BuildingHandle(uint16_t s, uint16_t g) : slot(s), generation(g) {}
+  bool isNull() const { return slot == 0xFFFF; }
+  bool operator==(const BuildingHandle& other) const { return slot == other.slot && generation == other.generation; }
+  bool operator!=(const BuildingHandle& other) const { return !(*this == other); }
+};
+
+// Smallest power of two >= v (compile-time table sizing)
+constexpr size_t nfcNextPow2(size_t v, size_t p = 1) { return p >= v ? p : nfcNextPow2(v, p << 1); }
 
 // Callback function type for new building events
 typedef std::function<void(uint8_t buildingType, const String& uid)> BuildingEventCallback;
+// Allocation-free variant receiving the binary UID
+typedef std::function<void(uint8_t buildingType, const CardUid& uid)> BuildingUidEventCallback;
+
+// What the scanner does when an already registered card is tapped again
+enum class KnownCardPolicy : uint8_t {
+  FullRead,  // always read and parse NDEF (tags may have been rewritten)
+  SkipRead,  // only refresh lastSeen, no NDEF read at all
+  VerifyHash // one READ of the first NDEF block; full read only if its hash changed
+};
+
+// Queued database change, produced by the scanner and consumed via popEvent()/dispatchEvents()
+struct BuildingEvent {
+  enum Type : uint8_t {
+    Added,     // card registered
+    Removed,   // card deleted
+    CardEnter, // presence tracking: card arrived on a reader
+    CardLeave  // presence tracking: card left the reader (after the hold-off)
+  };
+  Type type;
+  uint8_t buildingType;
+  uint8_t reader;          // index of the reader that saw the card, NoReader for API changes
+  CardUid uid;
+  unsigned long timestamp; // millis() when the change was applied
+#if NFC_REGISTRY_CARD_DATA_BYTES
+  NFCCardData data;        // card data of taps (Added, and Removed in delete mode); zeros otherwise
+#endif
+  
+  static constexpr uint8_t NoReader = 0xFF;
+};
+
+// One database change in the changefeed (see changesSince())
+struct BuildingChange {
+  enum Type : uint8_t {
+    Added,
+    Removed,
+    Cleared  // all cards removed; uid and buildingType are unused
+  };
+  uint32_t version;     // registry version after this change
+  Type type;
+  uint8_t buildingType;
+  CardUid uid;
+};
+
+enum class ChangeFeedStatus : uint8_t {
+  Complete,      // all changes up to the current version were returned
+  More,          // out was filled; call again from the last returned version
+  ResyncRequired // changes were lost (ring overflow, begin(), version unknown) - take a snapshot
+};
+
+// (uid, type) pair for the batch update API
+struct BuildingEntry {
+  CardUid uid;
+  uint8_t buildingType;
+};
+
+// Receives all changes made by one batch call (addBuildings() etc.) at once
+typedef std::function<void(const BuildingEvent* events, size_t count)> BuildingBatchCallback;
+
+// Allocation-free alternatives: plain function pointers with a user context
+typedef void (*BuildingEventFn)(const BuildingEvent& event, void* context);
+typedef void (*BuildingBatchFn)(const BuildingEvent* events, size_t count, void* context);
+
+// Callback receiving the full event (including reader index)
+typedef std::function<void(const BuildingEvent& event)> BuildingEventHandler;
+// Presence tracking callback (card enter/leave edges)
+typedef std::function<void(const CardUid& uid, uint8_t reader)> CardPresenceCallback;
 
 class NFCBuildingRegistry {
 private:
-  MFRC522* mfrc522;
-  std::map<String, BuildingCard> buildingDatabase; // UID -> BuildingCard mapping (protected by dbMutex)
-  mutable std::mutex dbMutex; // protects buildingDatabase
-  bool deleteMode;
+  // Open-addressing index sized to the next power of two >= 2x capacity,
+  // which keeps linear probe sequences short (load factor <= 0.5).
+  static constexpr size_t kCapacity = NFC_REGISTRY_MAX_CARDS;
+  static constexpr size_t kIndexSize = nfcNextPow2(kCapacity * 2);
+  static constexpr uint16_t kNoSlot = 0xFFFF;
+  static_assert(kCapacity > 0 && kCapacity < kNoSlot, "NFC_REGISTRY_MAX_CARDS must be in 1..65534");
+  // Card slots, their type/free and expiry links, generations, NDEF hashes and
+  // the hash index: 28 bytes per card plus 2 per index entry with the default
+  // timestamps, so the side arrays about double the 16-byte records
+  static constexpr size_t kStorageBytes =
+      kCapacity * (sizeof(BuildingCard) + 6 * sizeof(uint16_t)) + kIndexSize * sizeof(uint16_t);
+  static_assert(kStorageBytes <= NFC_REGISTRY_MAX_STORAGE_BYTES,
+                "NFC_REGISTRY_MAX_CARDS exceeds NFC_REGISTRY_MAX_STORAGE_BYTES");
+  
+  static constexpr uint8_t kMaxReaders = NFC_REGISTRY_MAX_READERS;
+  static_assert(kMaxReaders > 0 && kMaxReaders <= 32, "NFC_REGISTRY_MAX_READERS must be 1..32");
+  
+  MFRC522* readers[kMaxReaders];
+  uint8_t readerCount;
+  uint8_t nextReader; // round-robin position for poll()
+  // Building storage (all protected by dbMutex). Slots never move, so card
+  // pointers stay valid until that card is removed. uid.len == 0 marks a free slot.
+  BuildingCard slots[kCapacity];
+  uint16_t slotIndex[kIndexSize]; // hash position -> slot, kNoSlot when empty
+  uint16_t slotNext[kCapacity];   // next slot of the same type, or next free slot
+  uint16_t slotPrev[kCapacity];   // previous slot of the same type
+  uint16_t slotGeneration[kCapacity]; // bumped whenever a slot is freed (BuildingHandle)
+  uint16_t slotNdefHash[kCapacity];   // hash of the card's first NDEF block, 0 = not cached
+  // Expiry list: every card in lastSeen order, oldest at lruHead, so tick()
+  // only ever looks at the head
+  uint16_t lruPrev[kCapacity];
+  uint16_t lruNext[kCapacity];
+  uint16_t lruHead;
+  uint16_t lruTail;
+  uint32_t expiryTtlMs;     // setExpiry(), 0 = off
+  NFCTimestamp expiryTicks; // expiryTtlMs in timestamp ticks
+  uint16_t freeHead;
+  size_t buildingCount;
+  // Per-type secondary index: intrusive doubly linked list through slotNext/slotPrev
+  uint16_t typeHead[256];
+  uint16_t typeCount[256];
+  mutable NFCRegistryLock dbMutex; // protects building storage (NFC_REGISTRY_LOCK_POLICY)
+  // Seqlock over the building storage: every writer holds dbMutex and makes the
+  // sequence odd while it modifies anything, so point lookups and counters can
+  // read without locking and retry if a write overlapped (readOptimistic()).
+  std::atomic<uint32_t> dbSequence;
+  static constexpr uint8_t kOptimisticRetries = 4; // then fall back to dbMutex
+  class DbWriteLock {
+  public:
+    explicit DbWriteLock(NFCBuildingRegistry& registry);
+    ~DbWriteLock();
+  private:
+    NFCBuildingRegistry& registry;
+    DbWriteLock(const DbWriteLock&) = delete;
+    DbWriteLock& operator=(const DbWriteLock&) = delete;
+  };
+  template <typename Result, typename Reader>
+  Result readOptimistic(Reader reader) const;
+  std::atomic<bool> deleteMode;
   BuildingEventCallback onNewBuildingCallback;
   BuildingEventCallback onDeleteBuildingCallback;
+  BuildingUidEventCallback onNewBuildingUidCallback;
+  BuildingUidEventCallback onDeleteBuildingUidCallback;
+  BuildingEventHandler onBuildingEventCallback;
+  CardPresenceCallback onCardEnterCallback;
+  CardPresenceCallback onCardLeaveCallback;
+  BuildingBatchCallback onBatchCallback;
+  BuildingEventFn onBuildingEventFn;
+  void* onBuildingEventContext;
+  BuildingBatchFn onBatchFn;
+  void* onBatchContext;
+  
+  static constexpr size_t kNdefMaxBytes = NFC_REGISTRY_NDEF_MAX_BYTES;
+  static_assert(kNdefMaxBytes >= 16 && kNdefMaxBytes % 4 == 0 && kNdefMaxBytes <= 4 * 250,
+                "NFC_REGISTRY_NDEF_MAX_BYTES must be a multiple of 4 in 16..1000");
+  static constexpr uint8_t kNdefFirstPage = 4;
+  // FAST_READ response must fit the 64-byte MFRC522 FIFO together with its CRC
+  static constexpr uint8_t kFastReadMaxPages = 15;
+  // Longest wait for the answer to a REQA; the MFRC522 timer normally ends it at 25 ms
+  static constexpr uint32_t kRequestTimeoutMs = 40;
+  
+  // Non-blocking scanner: each poll() performs at most one PICC transaction
+  enum class ScanState : uint8_t {
+    Idle,           // waiting for a card (sends a REQA)
+    Detect,         // waiting for the answer to the REQA (ATQA or receive timeout)
+    Select,         // anticollision + select
+    ReadCapability, // read CC at page 3 (also returns the first 12 NDEF bytes)
+    ReadNdef,       // read the rest of the NDEF TLV (FAST_READ or 4 pages per step)
+    Reselect,       // re-activate a tag that rejected FAST_READ
+    Complete,       // halt card and update database
+    ProbeWake,      // presence tracking: WUPA to see if the resting card is still there
+    ProbeSelect,    // presence tracking: SELECT by the tracked UID to confirm it
+    Halt            // halt the selected card and return to Idle
+  };
+  
+  struct ScanContext {
+    MFRC522* reader;
+    uint8_t readerIndex;
+    ScanState state;
+    CardUid uid;
+    uint8_t nextPage;
+    bool skipNdef;      // card already known (or delete mode) - NDEF content not needed
+    bool verifyHash;    // known card under KnownCardPolicy::VerifyHash
+    bool typeFromNdef;  // the building type was read from a 'B' record
+    uint16_t blockHash; // hash of the block read at page 3, 0 if it cannot be cached
+    bool dataValid;     // data holds the card data fields of a complete NDEF message
+    NFCCardData data;
+    bool fastRead;      // tag is an NTAG21x and FAST_READ has not failed
+    size_t tagBytes;    // NDEF data area size from the CC
+    size_t readTarget;  // bytes needed to hold the complete NDEF TLV
+    size_t ndefSize;
+    uint8_t ndef[kNdefMaxBytes];
+    // Presence tracking
+    bool present;               // a processed card is resting on this reader
+    CardUid presentUid;
+    unsigned long lastResponse; // millis() of the last successful probe
+    unsigned long nextProbe;
+    // IRQ-driven detection (enableIrqDetection)
+    NFCBuildingRegistry* owner;     // for irqHandler()
+    int16_t irqPin;                 // -1 while polling ComIrqReg for REQA answers
+    bool irqArmed;                  // a REQA is out and RxIRq is routed to the pin
+    std::atomic<bool> irqPending;   // set by irqHandler()
+    uint32_t irqRequestIntervalMs;
+    unsigned long lastRequest;      // millis() of the last REQA sent
+    uint32_t ndefMicros;            // time spent reading this tap (NFC_REGISTRY_STATS)
+  };
+  bool fastReadEnabled;
+  bool presenceTracking;
+  uint32_t presenceProbeIntervalMs;
+  uint32_t presenceHoldOffMs;
+  KnownCardPolicy knownCardPolicy;
+  CardDataField cardDataFields[NFCCardData::kMaxFields]; // setCardDataFields()
+  uint8_t cardDataFieldCount;
+  ScanContext scans[kMaxReaders]; // one independent scanner per reader
+  uint32_t processedCards;        // taps completed by stepComplete(), for scanAllCards()
+  // Low-power duty cycling (setLowPowerScanning): readers look for new cards
+  // once per slot and are soft-powered-down between slots
+  bool lowPowerScanning;
+  bool readersPoweredDown;
+  bool lowPowerSlotOpen;
+  bool lowPowerSlotDetected;     // a reader saw a card during the current slot
+  uint32_t lowPowerPending;      // readers yet to look for a card in this slot (bit per reader)
+  uint32_t lowPowerFastMs;
+  uint32_t lowPowerSlowMs;
+  uint32_t lowPowerIdleMs;
+  uint32_t lowPowerIntervalMs;   // current slot interval, fastMs..slowMs
+  unsigned long nextScanAt;
+  unsigned long lastDetectionAt;
+  
+  void initReaders(MFRC522* const* readerList, uint8_t count);
+  // Returns false if poll()/scanForCards() should leave the readers alone;
+  // opens a new slot when one is due
+  bool lowPowerGate();
+  void finishLowPowerSlot(); // adapts the interval once a slot is over
+  void settleLowPower();     // ends a finished slot and powers down idle readers
+  void setReadersPoweredDown(bool down);
+  bool isAnyCardPresent() const;
+  // Advances one reader's scanner by one step. Returns true if the database changed.
+  bool pollReader(ScanContext& ctx);
+  
+  // Scan steps, one PICC transaction each
+  void stepDetect(ScanContext& ctx);
+  void stepSelect(ScanContext& ctx);
+  void onCardSelected(ScanContext& ctx); // picks the next step once ctx.uid is selected
+  void stepReadCapability(ScanContext& ctx);
+  void stepReadNdef(ScanContext& ctx);
+  void stepReselect(ScanContext& ctx);
+  bool stepComplete(ScanContext& ctx);
+  void stepProbeWake(ScanContext& ctx);
+  void stepProbeSelect(ScanContext& ctx);
+  void probeMissed(ScanContext& ctx); // no answer: absent once the hold-off has passed
+  void stepIrqRequest(ScanContext& ctx); // Idle step of a reader in IRQ mode
+  static void irqHandler(void* arg);      // ISR, arg is the reader's ScanContext
+  void markPresent(ScanContext& ctx);
+  void markAbsent(ScanContext& ctx);
+  // Decides how many more bytes to read based on the TLVs seen so far
+  void planNdefRead(ScanContext& ctx);
+  // NTAG21x FAST_READ (0x3A) of pages [startPage, endPage] in one RF exchange
+  static bool fastReadPages(MFRC522* reader, uint8_t startPage, uint8_t endPage, uint8_t* out);
+  // Starts a REQA transceive and returns without waiting for the answer
+  static void sendRequest(MFRC522* reader);
+  
+  // Resolves the building type of the scanned card from NDEF or the UID fallback
+  uint8_t resolveBuildingType(ScanContext& ctx);
+  // Applies add/delete semantics for the card scanned by ctx. Returns true if the database changed.
+  bool processCard(const ScanContext& ctx, uint8_t buildingType);
+  uint8_t registeredType(const CardUid& uid) const; // 0 if not registered
+  // Copies of the cards of one type (and their slots), taken without
+  // allocating while the lock is held
+  std::vector<BuildingCard> snapshotBuildingsOfType(uint8_t buildingType, std::vector<uint16_t>* slotsOut) const;
+  uint16_t cachedNdefHash(const CardUid& uid) const; // 0 if not registered or not cached
+  bool isCardDataLoaded(const CardUid& uid) const;   // false if not registered
+  static uint16_t hashNdefBlock(const uint8_t* block); // 16 bytes, never 0
+  
+  // Scan pipeline instrumentation; countStat()/recordStage()/StageTimer
+  // compile to nothing without NFC_REGISTRY_STATS
+  enum StatCounter : uint8_t {
+    StatReads, StatNdefFailures, StatUidFallbacks, StatAdds, StatRemoves, StatReTaps, StatLockContention,
+    StatHashHits, StatRewrites,
+    kStatCounterCount
+  };
+#if NFC_REGISTRY_STATS
+  NFCStageRecorder stageStats[static_cast<size_t>(ScanStage::Count)];
+  std::atomic<uint32_t> statCounters[kStatCounterCount];
+#endif
+  void countStat(StatCounter counter) {
+#if NFC_REGISTRY_STATS
+    statCounters[counter].fetch_add(1, std::memory_order_relaxed);
+#else
+    (void)counter;
+#endif
+  }
+  void recordStage(ScanStage stage, uint32_t micros) {
+#if NFC_REGISTRY_STATS
+    stageStats[static_cast<size_t>(stage)].record(micros);
+#else
+    (void)stage;
+    (void)micros;
+#endif
+  }
+  // Times the enclosing scope into a stage histogram, or adds it to a sum
+  class StageTimer {
+  public:
+#if NFC_REGISTRY_STATS
+    StageTimer(NFCBuildingRegistry& registry, ScanStage stage)
+      : registry(&registry), stage(stage), sum(nullptr), start(micros()) {}
+    explicit StageTimer(uint32_t& sum) : registry(nullptr), stage(ScanStage::Count), sum(&sum), start(micros()) {}
+    ~StageTimer() {
+      uint32_t elapsed = micros() - start;
+      if (sum) {
+        *sum += elapsed;
+      } else {
+        registry->recordStage(stage, elapsed);
+      }
+    }
+  private:
+    NFCBuildingRegistry* registry;
+    ScanStage stage;
+    uint32_t* sum;
+    uint32_t start;
+#else
+    StageTimer(NFCBuildingRegistry&, ScanStage) {}
+    explicit StageTimer(uint32_t&) {}
+#endif
+    StageTimer(const StageTimer&) = delete;
+    StageTimer& operator=(const StageTimer&) = delete;
+  };
+  
+  // Pending events (single producer: scanner, single consumer: application)
+  NFCEventRing<BuildingEvent, NFC_REGISTRY_EVENT_QUEUE_SIZE> eventQueue;
+  std::atomic<uint32_t> droppedEvents;
+  // Routes a database change to the event queue or straight to the callbacks
+  void emitEvent(BuildingEvent::Type type, uint8_t buildingType, const CardUid& uid, uint8_t readerIndex,
+                 const NFCCardData* data = nullptr);
+  void deliverEvent(const BuildingEvent& event);
+  // Hands a group of events to the batch callbacks, or event by event if none is set
+  void deliverEvents(const BuildingEvent* events, size_t count);
+  // Shared implementation of the batch API
+  size_t applyBatch(const BuildingEntry* added, size_t addCount, const CardUid* removed, size_t removeCount);
+  bool isQueueingEvents() const;
+  std::atomic<bool> deferredCallbacks;
+  static constexpr size_t kDispatchChunk = 8; // events handed to a batch callback at once
   
-  // NDEF parsing methods
-  // Reads NDEF data into a dynamically sized buffer (heap). Returns true if any data was read.
-  bool readNDEFData(std::vector<uint8_t>& ndefData);
-  // Parses building type from NDEF data buffer. Returns 0 if not found.
-  uint8_t parseNDEFBuildingType(const std::vector<uint8_t>& data);
-  String getCardUID();
+#if NFC_REGISTRY_PERSISTENCE
+  // Flash persistence: a snapshot file plus an append-only journal of changes
+  // made since. Both carry a generation number so a journal is only replayed
+  // on top of the snapshot it was started against.
+  enum JournalOp : uint8_t { JournalAdd = 1, JournalRemove = 2, JournalClear = 3 };
+  struct JournalRecord {
+    uint8_t op;
+    uint8_t buildingType;
+    CardUid uid;
+  };
+  static constexpr size_t kJournalPending = 16;
+  static constexpr size_t kJournalMaxRecords = NFC_REGISTRY_JOURNAL_MAX_RECORDS;
+  static constexpr size_t kPersistPathMax = 32;
+  fs::FS* persistFs;            // nullptr while persistence is off
+  char snapshotPath[kPersistPathMax];
+  char snapshotTmpPath[kPersistPathMax];
+  char journalPath[kPersistPathMax];
+  uint32_t persistGeneration;
+  size_t journalRecords;        // records in the journal file (persistMutex)
+  // Changes recorded under dbMutex, written to flash by persistChanges()
+  JournalRecord pendingJournal[kJournalPending];
+  size_t pendingJournalCount;
+  bool snapshotDue;             // pending overflowed or a write failed (dbMutex)
+  NFCPersistLock persistMutex;  // serializes flash writes; taken before dbMutex
+  
+  void journalLocked(uint8_t op, const CardUid& uid, uint8_t buildingType);
+  void persistChanges(); // call without dbMutex held
+  bool writeSnapshotLocked();
+  bool appendJournal(const JournalRecord* records, size_t count);
+  // Restore helpers; return false on a corrupt snapshot / a journal that must be rewritten
+  bool loadSnapshotLocked(fs::FS& fs, const char* path, uint32_t& generation);
+  bool replayJournalLocked(fs::FS& fs, uint32_t generation, size_t& records);
+#endif
+  
+#if defined(ESP32)
+  // Optional dedicated scanner task
+  std::atomic<TaskHandle_t> scannerTask;
+  std::atomic<bool> scannerStopRequested;
+  uint32_t scannerIdleDelayMs;
+  static void scannerTaskEntry(void* arg);
+#endif
+  
+  // Fire callbacks for an add/remove; String variants only allocate when set
+  void notifyNewBuilding(uint8_t buildingType, const CardUid& uid);
+  void notifyDeleteBuilding(uint8_t buildingType, const CardUid& uid);
+  
+  // Changefeed: version counter plus a ring of the latest changes (under dbMutex)
+  static constexpr size_t kChangeLogSize = NFC_REGISTRY_CHANGELOG_SIZE;
+  static_assert(kChangeLogSize > 0 && (kChangeLogSize & (kChangeLogSize - 1)) == 0,
+                "NFC_REGISTRY_CHANGELOG_SIZE must be a power of two");
+  BuildingChange changeLog[kChangeLogSize];
+  std::atomic<uint32_t> dbVersion;
+  uint32_t changeFloor; // changes up to this version are no longer available
+  // Bumps the version, logs the change and journals it for persistence
+  void recordChangeLocked(BuildingChange::Type type, const CardUid& uid, uint8_t buildingType);
+  
+  // Wire format (NFCRegistrySerialization.cpp). deserializeLocked() adds the
+  // decoded cards to the current contents; false on malformed input. dropped
+  // is set if cards did not fit, for the caller to log once the lock is released.
+  size_t serializeLocked(Print& out) const; // bytes written, 0 on a write error
+  bool deserializeLocked(Stream& in, uint32_t* version, bool& dropped);
+  
+  // Storage helpers - callers must hold dbMutex (DbWriteLock when modifying)
+  static size_t hashKey(const CardUid& key);
+  size_t findIndexPos(const CardUid& key) const;   // kIndexSize if absent
+  // Slot of key or kNoSlot. Also safe inside readOptimistic(): every index is
+  // read once and bounds-checked, and probing is bounded.
+  uint16_t findSlot(const CardUid& key) const;
+  BuildingCard* findCardLocked(const CardUid& key);
+  const BuildingCard* findCardLocked(const CardUid& key) const;
+  // Existing card, or a newly inserted one (inserted = true); nullptr if full
+  BuildingCard* findOrInsertLocked(const CardUid& key, uint8_t buildingType, bool& inserted);
+  void eraseAtLocked(size_t indexPos);
+  void resetStorageLocked();
+  void linkTypeLocked(uint16_t slot);
+  void unlinkTypeLocked(uint16_t slot);
+  void linkLruLocked(uint16_t slot); // append as the most recently seen card
+  void unlinkLruLocked(uint16_t slot);
+  void sortLruLocked();              // after restoring cards with arbitrary ages
+  // Sets lastSeen and moves the card to the end of the expiry list
+  void touchLocked(BuildingCard& card, unsigned long ms);
+  // Applies a rewritten tag's type, recorded as a remove + add of the same UID
+  void rewriteLocked(uint16_t slot, uint8_t buildingType);
   
 public:
   // Constructor
   NFCBuildingRegistry(MFRC522* reader);
+  // Multi-reader constructor: up to NFC_REGISTRY_MAX_READERS readers (e.g. on a
+  // shared SPI bus with separate SS pins) feeding one shared database
+  NFCBuildingRegistry(MFRC522* const* readerList, uint8_t count);
   
   // Destructor
   ~NFCBuildingRegistry();
   
-  // Main scanning method - call this in your loop()
+  // Main scanning method - call this in your loop(). Checks every reader once and
+  // blocks until any detected tap has been fully read (several SPI transactions).
   bool scanForCards();
   
+  // Like scanForCards(), but keeps running REQA + anticollision on each reader
+  // until no unprocessed card answers, so a whole stack placed at once is
+  // read in one call. Every processed card is halted and thus drops out of
+  // the next round. Returns the number of cards processed (at most maxCards).
+  size_t scanAllCards(size_t maxCards = 16);
+  
+  // Non-blocking alternative to scanForCards(): advances the next reader (round
+  // robin) by at most one PICC transaction and returns immediately. Returns true
+  // on the call that added or removed a building.
+  bool poll();
+  bool isScanInProgress() const; // true while any reader is mid-tap
+  
+  uint8_t getReaderCount() const;
+  MFRC522* getReader(uint8_t index) const;
+  
+  // Use the NTAG21x FAST_READ command to fetch the NDEF message in a single RF
+  // exchange (default on). Other tags always use 4-page READs.
+  void setFastReadEnabled(bool enabled);
+  bool isFastReadEnabled() const;
+  
+  // Re-taps of registered cards skip the NDEF read by default, since only
+  // lastSeen changes. Use FullRead if tags can be rewritten while registered.
+  void setKnownCardPolicy(KnownCardPolicy policy);
+  KnownCardPolicy getKnownCardPolicy() const;
+  
+  // Extra NDEF records copied into BuildingCard::data and BuildingEvent::data
+  // while the tag is read (needs NFC_REGISTRY_CARD_DATA_BYTES). Up to
+  // NFCCardData::kMaxFields fields; returns false, keeping the previous
+  // fields, if one does not fit the data area. Cards are re-read on their
+  // next tap until their data has been loaded from the tag.
+  bool setCardDataFields(const CardDataField* fields, uint8_t count);
+  uint8_t getCardDataFieldCount() const;
+  
+  // Expiry: tick() removes cards whose lastSeen is ttlMs or more in the
+  // past, oldest first, with delete callbacks and Removed events (reader
+  // NoReader). Cards resting on a reader under presence tracking stay fresh.
+  // Returns false if ttlMs is not below half the timestamp range (see
+  // NFC_REGISTRY_TIMESTAMP_BITS). 0 disables expiry (the default).
+  bool setExpiry(uint32_t ttlMs);
+  uint32_t getExpiry() const;
+  // Retires at most maxRemovals (up to kTickMaxRemovals) expired cards and
+  // returns how many were removed. Cheap when nothing is due; call it from loop().
+  static constexpr size_t kTickMaxRemovals = 16;
+  size_t tick(size_t maxRemovals = 8);
+  
+  // Presence tracking: once a card has been processed, a reader stops
+  // re-selecting it and instead probes it every probeIntervalMs with a
+  // WUPA + SELECT of its UID (other cards of a stack stay silent). The card
+  // counts as gone (onCardLeave) after it has not answered for holdOffMs.
+  // Disabled by default.
+  void setPresenceTracking(bool enabled, uint32_t probeIntervalMs = 100, uint32_t holdOffMs = 300);
+  bool isPresenceTracking() const;
+  bool isCardPresent(uint8_t readerIndex, CardUid* uid = nullptr) const;
+  
+  // Interrupt-driven detection: instead of a REQA on every idle poll and
+  // register reads for its answer, a reader sends a REQA every
+  // requestIntervalMs and routes RxIRq to its IRQ pin (irqPin, wired to the
+  // MFRC522 IRQ output).
+  // Anticollision and reads only start once a card has answered, and the
+  // scanner task sleeps until then. Call after PCD_Init() and while the
+  // scanner task is stopped. Returns false for an invalid reader or while the
+  // scanner task runs.
+  bool enableIrqDetection(uint8_t readerIndex, uint8_t irqPin, uint32_t requestIntervalMs = 10);
+  void disableIrqDetection(uint8_t readerIndex);
+  bool isIrqDetectionEnabled(uint8_t readerIndex) const;
+  
+  // Duty-cycled scanning for battery-powered units. Readers look for new cards
+  // once every fastIntervalMs and are soft-powered-down (antenna and analog
+  // part off) in between; poll()/scanForCards() return at once outside a scan
+  // slot. After idleTimeoutMs without a card the interval doubles per empty
+  // slot up to slowIntervalMs, which bounds the detection latency, and drops
+  // back to fastIntervalMs on the next detection. Readers stay powered while
+  // a tap is processed or presence tracking sees a resting card. Cannot be
+  // combined with IRQ detection; returns false if a reader uses it or the
+  // scanner task runs.
+  bool setLowPowerScanning(bool enabled, uint32_t fastIntervalMs = 100, uint32_t slowIntervalMs = 1000,
+                           uint32_t idleTimeoutMs = 30000);
+  bool isLowPowerScanning() const;
+  uint32_t getScanIntervalMs() const; // current slot interval
+  // Milliseconds until poll() has work to do again (0 = poll now)
+  uint32_t getTimeToNextScan() const;
+  // Powers down idle readers and sleeps until the next slot: light sleep on
+  // ESP32, delay() on ESP8266 (the SDK light-sleeps there when WiFi is in
+  // WIFI_LIGHT_SLEEP mode). Call from loop() after poll(); not with the scanner task.
+  void sleepUntilNextScan();
+  
+#if defined(ESP32)
+  // Runs the scanner in its own FreeRTOS task pinned to `core`. While it runs,
+  // callbacks are no longer invoked from the scanner; changes are queued and
+  // delivered on the caller's thread by dispatchEvents()/popEvent(). poll() and
+  // scanForCards() become no-ops for other tasks. Returns false if the task
+  // could not be created, is already running, or the lock policy is NONE.
+  bool startScannerTask(BaseType_t core = 0, UBaseType_t priority = 2,
+                        uint32_t stackSize = 4096, uint32_t idleDelayMs = 10);
+  void stopScannerTask(); // blocks until the task has exited
+  bool isScannerTaskRunning() const;
+#endif
+  
+  // Event queue (filled while the scanner task runs, or when callbacks are deferred)
+  bool popEvent(BuildingEvent& event);
+  // Pops up to maxEvents queued events and invokes the matching callbacks -
+  // with a batch callback set, in groups of up to 8 events per call.
+  // Returns number dispatched.
+  size_t dispatchEvents(size_t maxEvents = SIZE_MAX);
+  // Queue scanner events instead of calling callbacks from inside poll()/
+  // scanForCards(); the application then delivers them with dispatchEvents()
+  // when convenient. Always on while the scanner task runs. At most
+  // NFC_REGISTRY_EVENT_QUEUE_SIZE events are held (see getDroppedEventCount()).
+  void setDeferredCallbacks(bool deferred);
+  bool isDeferredCallbacks() const;
+  size_t getPendingEventCount() const;
+  uint32_t getDroppedEventCount() const; // events lost because the queue was full
+  
+  // Scan pipeline statistics since start or resetStats(): per-stage latency
+  // histograms and counters. All zero unless built with NFC_REGISTRY_STATS=1.
+  void getStats(NFCRegistryStats& out) const;
+  void resetStats();
+  
+#if NFC_REGISTRY_PERSISTENCE
+  // Enables flash persistence on an already mounted filesystem (e.g. after
+  // LittleFS.begin()) and restores the registry from it. Files are named
+  // basePath + ".snp" / ".jnl" / ".tmp". Adds and removes are journaled as
+  // they happen; lastSeen refreshes are not (to spare the flash) and only reach
+  // flash with the next snapshot. Returns false if stored data was unreadable;
+  // persistence stays enabled and starts from what could be recovered.
+  bool begin(fs::FS& fs, const char* basePath = "/nfcreg");
+  // Writes a fresh snapshot now and truncates the journal
+  bool saveSnapshot();
+  bool isPersistenceEnabled() const;
+#endif
+  
   // Mode management
   void setDeleteMode(bool enabled);
   bool isDeleteMode() const;
@@ -66,23 +832,109 @@ public:
   // Database management
   void clearDatabase();
   size_t getDatabaseSize() const;
+  static constexpr size_t getCapacity() { return kCapacity; }
+  static constexpr size_t getStorageBytes() { return kStorageBytes; } // RAM used by card storage
   
   // Query methods
   std::map<String, BuildingCard> getAllBuildings() const; // snapshot copy under lock
-  std::vector<BuildingCard> snapshotBuildings() const;    // lighter-weight snapshot
+  // Lighter-weight snapshot; optionally also returns the version it reflects
+  std::vector<BuildingCard> snapshotBuildings(uint32_t* version = nullptr) const;
   std::map<String, BuildingCard*> getBuildingsByType(uint8_t buildingType);
+  
+  // Zero-copy iteration: calls visitor(const BuildingCard&) for every card (or
+  // every card of one type) in place, under a single lock hold and without
+  // allocating. The visitor must be short and must not call back into the
+  // registry. Returns the number of cards visited.
+  template <typename Visitor>
+  size_t forEachBuilding(Visitor&& visitor) const {
+    NFCLockGuard<NFCRegistryLock> lock(dbMutex);
+    size_t visited = 0;
+    for (size_t i = 0; i < kCapacity && visited < buildingCount; i++) {
+      if (slots[i].uid.len) {
+        visitor(static_cast<const BuildingCard&>(slots[i]));
+        visited++;
+      }
+    }
+    return visited;
+  }
+  template <typename Visitor>
+  size_t forEachBuildingOfType(uint8_t buildingType, Visitor&& visitor) const {
+    NFCLockGuard<NFCRegistryLock> lock(dbMutex);
+    size_t visited = 0;
+    for (uint16_t i = typeHead[buildingType]; i != kNoSlot; i = slotNext[i]) {
+      visitor(static_cast<const BuildingCard&>(slots[i]));
+      visited++;
+    }
+    return visited;
+  }
   bool hasBuildingType(uint8_t buildingType) const;
   size_t getBuildingCount(uint8_t buildingType) const;
   
-  // Card management
+  // Card management (hex string UIDs)
   bool addBuilding(const String& uid, uint8_t buildingType);
   bool removeBuilding(const String& uid);
   bool hasBuilding(const String& uid) const;
   BuildingCard* getBuilding(const String& uid);
   
+  // Card management (binary UIDs, no heap allocation)
+  bool addBuilding(const CardUid& uid, uint8_t buildingType);
+  bool removeBuilding(const CardUid& uid);
+  bool hasBuilding(const CardUid& uid) const;
+  BuildingCard* getBuilding(const CardUid& uid);
+  
+  // Batch updates (e.g. restoring a game from a server): the whole batch is
+  // applied under one lock hold, then the changes are reported on the
+  // caller's thread - to the batch callback if one is set, otherwise to the
+  // regular per-card callbacks. applyDelta() applies removals before additions.
+  // Return the number of cards actually added/removed.
+  size_t addBuildings(const BuildingEntry* entries, size_t count);
+  size_t removeBuildings(const CardUid* uids, size_t count);
+  size_t applyDelta(const BuildingEntry* added, size_t addCount, const CardUid* removed, size_t removeCount);
+  
+  // Changefeed for mirroring the registry: the version is bumped by every add,
+  // remove and clear (not by lastSeen refreshes). changesSince() copies up to
+  // maxCount changes newer than sinceVersion, oldest first, into out. Start
+  // with snapshotBuildings(&version) and then poll changesSince(version, ...).
+  uint32_t getVersion() const;
+  ChangeFeedStatus changesSince(uint32_t sinceVersion, BuildingChange* out, size_t maxCount, size_t& count) const;
+  
+  // Compact binary export/import of the whole registry (raw UIDs, types,
+  // varint ages), streamed straight from/into the card storage. Includes the
+  // registry version, so a mirror can continue with changesSince() after an
+  // import. The lock is held while streaming, so use a fast Print/Stream
+  // (buffer, file) rather than a network client. deserialize() replaces the
+  // current contents and does not invoke callbacks; on malformed input it
+  // returns false and the registry keeps the cards decoded so far.
+  size_t serialize(Print& out) const;                    // bytes written
+  size_t serialize(uint8_t* buffer, size_t size) const;  // 0 if the buffer is too small
+  size_t getSerializedSize() const;
+  bool deserialize(Stream& in, uint32_t* version = nullptr);
+  bool deserialize(const uint8_t* data, size_t size, uint32_t* version = nullptr);
+  
+  // Handle-based access. Unlike the BuildingCard* getters, which return
+  // pointers that are only safe while nothing else modifies the registry,
+  // handles can be held across tasks/cores: readBuilding() copies the current
+  // record under the lock and fails once the card has been removed.
+  BuildingHandle getBuildingHandle(const CardUid& uid) const;   // null handle if not registered
+  BuildingHandle getBuildingHandle(const String& uid) const;
+  bool readBuilding(BuildingHandle handle, BuildingCard& out) const; // false if stale
+  bool isHandleValid(BuildingHandle handle) const;
+  // Fills out with handles to up to maxCount cards of a type. Returns the number written.
+  size_t getBuildingHandles(uint8_t buildingType, BuildingHandle* out, size_t maxCount) const;
+  
   // Event callbacks
   void setOnNewBuildingCallback(BuildingEventCallback callback);
   void setOnDeleteBuildingCallback(BuildingEventCallback callback);
+  void setOnNewBuildingCallback(BuildingUidEventCallback callback);
+  void setOnDeleteBuildingCallback(BuildingUidEventCallback callback);
+  // Receives both add and remove events with the originating reader index
+  void setOnBuildingEventCallback(BuildingEventHandler callback);
+  void setOnCardEnterCallback(CardPresenceCallback callback);
+  void setOnCardLeaveCallback(CardPresenceCallback callback);
+  void setOnBatchCallback(BuildingBatchCallback callback);
+  // Function pointer variants (never allocate); pass nullptr to clear
+  void setOnBuildingEventCallback(BuildingEventFn callback, void* context);
+  void setOnBatchCallback(BuildingBatchFn callback, void* context);
   
   // Utility methods
   void printDatabase() const;
@@ -91,6 +943,12 @@ public:
   // Static utility methods
   static String uidToString(byte* uid, byte uidSize);
   static void printUID(byte* uid, byte uidSize);
+  static void printUID(const CardUid& uid);
+  
+  // Destination for library log messages (default &Serial, nullptr = discard).
+  // Has no effect when NFC_REGISTRY_LOG_LEVEL is NFC_LOG_LEVEL_NONE.
+  static void setLogOutput(Print* output);
+  static Print* getLogOutput();
 };
 
 #endif // NFC_BUILDING_REGISTRY_H
@@ -0,0 +1,53 @@
+#ifndef NFC_EVENT_RING_H
+#define NFC_EVENT_RING_H
+
+#include <stddef.h>
+#include <atomic>
+
+// Fixed-size single-producer/single-consumer ring buffer.
+// push() may only be called from one thread (e.g. the scanner task) and
+// pop() from one other thread (e.g. loop()); neither side ever blocks or
+// allocates. N must be a power of two.
+template <typename T, size_t N>
+class NFCEventRing {
+  static_assert(N > 0 && (N & (N - 1)) == 0, "NFCEventRing size must be a power of two");
+
+public:
+  NFCEventRing() : head(0), tail(0) {}
+
+  // Producer side. Returns false (and drops the item) when the ring is full.
+  bool push(const T& item) {
+    size_t h = head.load(std::memory_order_relaxed);
+    if (h - tail.load(std::memory_order_acquire) >= N) {
+      return false;
+    }
+    items[h & (N - 1)] = item;
+    head.store(h + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer side. Returns false when the ring is empty.
+  bool pop(T& out) {
+    size_t t = tail.load(std::memory_order_relaxed);
+    if (t == head.load(std::memory_order_acquire)) {
+      return false;
+    }
+    out = items[t & (N - 1)];
+    tail.store(t + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Approximate when called concurrently with push()/pop()
+  size_t size() const {
+    return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+  }
+  bool empty() const { return size() == 0; }
+  static constexpr size_t capacity() { return N; }
+
+private:
+  T items[N];
+  std::atomic<size_t> head; // written by producer only
+  std::atomic<size_t> tail; // written by consumer only
+};
+
+#endif // NFC_EVENT_RING_H
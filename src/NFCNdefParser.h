@@ -0,0 +1,157 @@
+#ifndef NFC_NDEF_PARSER_H
+#define NFC_NDEF_PARSER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Single-pass parsing of the NDEF area of an NFC Forum Type 2 tag (the bytes
+// from page 4 on). Works on a borrowed span: nothing is copied or allocated
+// and results point into the caller's buffer.
+
+enum class NdefParseStatus : uint8_t {
+  Found,     // the TLV / record is present
+  NotFound,  // the data is well formed but does not contain it
+  Malformed  // a header or length runs past the data, or is invalid
+};
+
+// Value of the NDEF message TLV. length is the declared length and may
+// extend past the bytes read so far.
+struct NdefMessageSpan {
+  NdefParseStatus status;
+  size_t offset;
+  size_t length;
+};
+
+// Payload of a matching record; points into the parsed buffer
+struct NdefRecordView {
+  NdefParseStatus status;
+  const uint8_t* payload;
+  size_t payloadLength;
+
+  bool found() const { return status == NdefParseStatus::Found; }
+};
+
+// NotFound means a Terminator TLV was reached; Malformed that the TLV headers
+// continue past size (i.e. more data has to be read).
+inline NdefMessageSpan findNdefMessage(const uint8_t* data, size_t size) {
+  size_t i = 0;
+  while (i < size) {
+    uint8_t tlvType = data[i];
+    if (tlvType == 0x00) { // NULL TLV (padding)
+      i++;
+      continue;
+    }
+    if (tlvType == 0xFE) { // Terminator TLV
+      return {NdefParseStatus::NotFound, i, 0};
+    }
+    if (size - i < 2) break;
+    size_t len = data[i + 1];
+    size_t header = 2;
+    if (len == 0xFF) { // extended length (2 bytes)
+      if (size - i < 4) break;
+      len = (static_cast<size_t>(data[i + 2]) << 8) | data[i + 3];
+      header = 4;
+    }
+    if (tlvType == 0x03) { // NDEF Message TLV
+      return {NdefParseStatus::Found, i + header, len};
+    }
+    i += header + len; // skip lock/memory control and proprietary TLVs
+  }
+  return {NdefParseStatus::Malformed, size, 0};
+}
+
+// Compile-time record type comparison, unrolled per character
+template <uint8_t... Chars>
+struct NdefTypeMatch {
+  static bool at(const uint8_t*) { return true; }
+};
+
+template <uint8_t First, uint8_t... Rest>
+struct NdefTypeMatch<First, Rest...> {
+  static bool at(const uint8_t* p) { return *p == First && NdefTypeMatch<Rest...>::at(p + 1); }
+};
+
+// One record of the NDEF message; pointers into the parsed buffer
+struct NdefRecord {
+  uint8_t flags;         // MB/ME/CF/SR/IL bits and the TNF
+  const uint8_t* type;
+  size_t typeLength;
+  const uint8_t* payload;
+  size_t payloadLength;
+};
+
+// Calls visitor(const NdefRecord&) for each record of the NDEF message TLV,
+// in order, until it returns false. Returns Found if the visitor stopped the
+// walk, NotFound if the whole message was visited, and Malformed if the
+// message is cut short (partial read) or a record header is invalid.
+template <typename Visitor>
+NdefParseStatus forEachNdefRecord(const uint8_t* data, size_t size, Visitor&& visitor) {
+  if (!data || size == 0) {
+    return NdefParseStatus::NotFound;
+  }
+  NdefMessageSpan message = findNdefMessage(data, size);
+  if (message.status != NdefParseStatus::Found) {
+    return message.status;
+  }
+
+  const bool complete = message.length <= size - message.offset;
+  const uint8_t* p = data + message.offset;
+  const uint8_t* end = complete ? p + message.length : data + size;
+  while (p < end) {
+    // flags | type length | payload length (1 or 4) | [id length]
+    NdefRecord record;
+    record.flags = p[0];
+    const bool shortRecord = (record.flags & 0x10) != 0; // SR
+    const bool hasId = (record.flags & 0x08) != 0;       // IL
+    const size_t fixed = (shortRecord ? 3 : 6) + (hasId ? 1 : 0);
+    if (static_cast<size_t>(end - p) < fixed) break;
+
+    record.typeLength = p[1];
+    if (shortRecord) {
+      record.payloadLength = p[2];
+    } else {
+      record.payloadLength = (static_cast<size_t>(p[2]) << 24) | (static_cast<size_t>(p[3]) << 16) |
+                             (static_cast<size_t>(p[4]) << 8) | p[5];
+    }
+    const size_t idLen = hasId ? p[fixed - 1] : 0;
+    p += fixed;
+
+    // Type, id and payload must fit; checked in steps to avoid size_t overflow
+    const size_t avail = static_cast<size_t>(end - p);
+    if (record.typeLength + idLen > avail) break;
+    if (record.payloadLength > avail - record.typeLength - idLen) break;
+    record.type = p;
+    record.payload = p + record.typeLength + idLen;
+    if (!visitor(static_cast<const NdefRecord&>(record))) {
+      return NdefParseStatus::Found;
+    }
+    p = record.payload + record.payloadLength;
+
+    if (record.flags & 0x40) { // ME (Message End)
+      return NdefParseStatus::NotFound;
+    }
+  }
+  // Ran out of bytes inside the message (or a record header is cut short)
+  return (complete && p == end) ? NdefParseStatus::NotFound : NdefParseStatus::Malformed;
+}
+
+// Finds the first record of type RecordType... (e.g. findNdefRecord<'B'>) in
+// the NDEF message TLV. A message cut short by a partial read is Malformed
+// unless the complete record was found before the cut.
+template <uint8_t... RecordType>
+NdefRecordView findNdefRecord(const uint8_t* data, size_t size) {
+  static_assert(sizeof...(RecordType) > 0 && sizeof...(RecordType) < 256, "NDEF record type must be 1..255 bytes");
+
+  NdefRecordView result = {NdefParseStatus::NotFound, nullptr, 0};
+  result.status = forEachNdefRecord(data, size, [&result](const NdefRecord& record) {
+    if (record.typeLength == sizeof...(RecordType) && NdefTypeMatch<RecordType...>::at(record.type)) {
+      result.payload = record.payload;
+      result.payloadLength = record.payloadLength;
+      return false;
+    }
+    return true;
+  });
+  return result;
+}
+
+#endif // NFC_NDEF_PARSER_H
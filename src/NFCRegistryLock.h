@@ -0,0 +1,66 @@
+#ifndef NFC_REGISTRY_LOCK_H
+#define NFC_REGISTRY_LOCK_H
+
+// Lock types selected by NFC_REGISTRY_LOCK_POLICY (see NFCBuildingRegistry.h).
+// All of them provide lock()/try_lock()/unlock() and are used through NFCLockGuard.
+
+#if NFC_REGISTRY_LOCK_POLICY == NFC_LOCK_POLICY_MUTEX
+  #include <mutex>
+#endif
+
+// For registries only touched from a single loop(): compiles to nothing
+class NFCNoLock {
+public:
+  void lock() {}
+  bool try_lock() { return true; }
+  void unlock() {}
+};
+
+#if defined(ESP32)
+// portMUX critical section: cheap and safe against the other core and ISRs,
+// but interrupts stay disabled while it is held, so it must never be held
+// across flash access, Serial output, heap allocation or anything else that
+// blocks. The static initializer works on every ESP-IDF version
+// (vPortCPUInitializeMutex() is gone in IDF 5).
+class NFCSpinLock {
+public:
+  NFCSpinLock() {}
+  void lock() { portENTER_CRITICAL(&mux); }
+  bool try_lock() { lock(); return true; } // spins; only used by the statistics
+  void unlock() { portEXIT_CRITICAL(&mux); }
+
+private:
+  portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
+  NFCSpinLock(const NFCSpinLock&) = delete;
+  NFCSpinLock& operator=(const NFCSpinLock&) = delete;
+};
+#endif
+
+// Scoped lock for any of the types above (<mutex>, and with it std::lock_guard,
+// is not usable on ESP8266)
+template <typename Lock>
+class NFCLockGuard {
+public:
+  explicit NFCLockGuard(Lock& lock) : guarded(lock) { guarded.lock(); }
+  ~NFCLockGuard() { guarded.unlock(); }
+
+private:
+  Lock& guarded;
+  NFCLockGuard(const NFCLockGuard&) = delete;
+  NFCLockGuard& operator=(const NFCLockGuard&) = delete;
+};
+
+// NFCRegistryLock guards the building storage. NFCPersistLock serializes
+// flash writes and is held across file I/O, so it is never a spinlock.
+#if NFC_REGISTRY_LOCK_POLICY == NFC_LOCK_POLICY_NONE
+  typedef NFCNoLock NFCRegistryLock;
+  typedef NFCNoLock NFCPersistLock;
+#elif NFC_REGISTRY_LOCK_POLICY == NFC_LOCK_POLICY_SPINLOCK
+  typedef NFCSpinLock NFCRegistryLock;
+  typedef NFCNoLock NFCPersistLock; // persistence is unavailable with spinlocks
+#else
+  typedef std::mutex NFCRegistryLock;
+  typedef std::mutex NFCPersistLock;
+#endif
+
+#endif // NFC_REGISTRY_LOCK_H
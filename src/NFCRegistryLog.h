@@ -0,0 +1,43 @@
+#ifndef NFC_REGISTRY_LOG_H
+#define NFC_REGISTRY_LOG_H
+
+// Internal logging macros used by the library's .cpp files. Messages above
+// NFC_REGISTRY_LOG_LEVEL are removed by the preprocessor, arguments included,
+// so the default (silent) build carries no formatting or printing code.
+
+#include "NFCBuildingRegistry.h"
+
+// printf-style write of one line to the configured sink (stack buffer, no heap)
+void nfcLogPrintf(const char* format, ...) __attribute__((format(printf, 1, 2)));
+
+// Temporary hex rendering of a UID for "%s": NFC_LOGI("UID=%s", NFCLogHex(uid).str)
+struct NFCLogHex {
+  char str[NFC_UID_HEX_LEN + 1];
+  explicit NFCLogHex(const CardUid& uid) { uid.toHex(str); }
+};
+
+#if NFC_REGISTRY_LOG_LEVEL >= NFC_LOG_LEVEL_ERROR
+  #define NFC_LOGE(...) nfcLogPrintf(__VA_ARGS__)
+#else
+  #define NFC_LOGE(...) do {} while (0)
+#endif
+
+#if NFC_REGISTRY_LOG_LEVEL >= NFC_LOG_LEVEL_WARN
+  #define NFC_LOGW(...) nfcLogPrintf(__VA_ARGS__)
+#else
+  #define NFC_LOGW(...) do {} while (0)
+#endif
+
+#if NFC_REGISTRY_LOG_LEVEL >= NFC_LOG_LEVEL_INFO
+  #define NFC_LOGI(...) nfcLogPrintf(__VA_ARGS__)
+#else
+  #define NFC_LOGI(...) do {} while (0)
+#endif
+
+#if NFC_REGISTRY_LOG_LEVEL >= NFC_LOG_LEVEL_DEBUG
+  #define NFC_LOGD(...) nfcLogPrintf(__VA_ARGS__)
+#else
+  #define NFC_LOGD(...) do {} while (0)
+#endif
+
+#endif // NFC_REGISTRY_LOG_H
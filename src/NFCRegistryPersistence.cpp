@@ -0,0 +1,349 @@
+#include "NFCBuildingRegistry.h"
+
+#if NFC_REGISTRY_PERSISTENCE
+
+#include "NFCRegistryLog.h"
+
+// On-flash layout (integers little-endian):
+//   snapshot: "NFRS" | version | generation u32 | registry wire format (see
+//             NFCRegistrySerialization.cpp) | crc32 of everything before
+//   journal:  "NFRJ" | version | generation u32 |
+//             n x (op | uidLen | uid | type | crc8)
+// The wire format stores card ages relative to the time of writing, so
+// relative ages survive a reboot (time spent powered off is not counted).
+
+constexpr size_t NFCBuildingRegistry::kJournalPending;
+constexpr size_t NFCBuildingRegistry::kJournalMaxRecords;
+constexpr size_t NFCBuildingRegistry::kPersistPathMax;
+
+static const uint8_t kSnapshotMagic[4] = {'N', 'F', 'R', 'S'};
+static const uint8_t kJournalMagic[4] = {'N', 'F', 'R', 'J'};
+static const uint8_t kPersistVersion = 2;
+
+static uint32_t crc32Update(uint32_t crc, const uint8_t* data, size_t len) {
+  crc = ~crc;
+  while (len--) {
+    crc ^= *data++;
+    for (uint8_t bit = 0; bit < 8; bit++) {
+      crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1u)));
+    }
+  }
+  return ~crc;
+}
+
+static uint8_t crc8(const uint8_t* data, size_t len) {
+  uint8_t crc = 0;
+  while (len--) {
+    crc ^= *data++;
+    for (uint8_t bit = 0; bit < 8; bit++) {
+      crc = (crc & 0x80) ? static_cast<uint8_t>((crc << 1) ^ 0x07) : static_cast<uint8_t>(crc << 1);
+    }
+  }
+  return crc;
+}
+
+static void putU32(uint8_t* out, uint32_t value) {
+  for (uint8_t i = 0; i < 4; i++) {
+    out[i] = static_cast<uint8_t>(value >> (8 * i));
+  }
+}
+
+static uint32_t getU32(const uint8_t* in) {
+  return static_cast<uint32_t>(in[0]) | (static_cast<uint32_t>(in[1]) << 8) |
+         (static_cast<uint32_t>(in[2]) << 16) | (static_cast<uint32_t>(in[3]) << 24);
+}
+
+// Pass-through Print/Stream that keep a CRC-32 of the bytes written/read
+class NFCCrcPrint : public Print {
+public:
+  explicit NFCCrcPrint(Print& out) : out(out), crc(0), failed(false) {}
+  size_t write(uint8_t b) override { return write(&b, 1); }
+  size_t write(const uint8_t* data, size_t count) override {
+    size_t written = out.write(data, count);
+    crc = crc32Update(crc, data, written);
+    failed |= written != count;
+    return written;
+  }
+  Print& out;
+  uint32_t crc;
+  bool failed;
+};
+
+// Reads through to a file, checksumming. No timeout: a short file is
+// corrupt, so readBytes() must fail at once instead of waiting under the lock.
+class NFCCrcStream : public Stream {
+public:
+  explicit NFCCrcStream(Stream& in) : in(in), crc(0) {
+    setTimeout(0);
+  }
+  int available() override { return in.available(); }
+  int peek() override { return in.peek(); }
+  int read() override {
+    int c = in.read();
+    if (c >= 0) {
+      uint8_t b = static_cast<uint8_t>(c);
+      crc = crc32Update(crc, &b, 1);
+    }
+    return c;
+  }
+  size_t write(uint8_t) override { return 0; }
+  Stream& in;
+  uint32_t crc;
+};
+
+// Header shared by both files: magic | version | generation
+static void putHeader(uint8_t* out, const uint8_t* magic, uint32_t generation) {
+  memcpy(out, magic, 4);
+  out[4] = kPersistVersion;
+  putU32(out + 5, generation);
+}
+
+static bool checkHeader(const uint8_t* in, const uint8_t* magic) {
+  return memcmp(in, magic, 4) == 0 && in[4] == kPersistVersion;
+}
+
+bool NFCBuildingRegistry::begin(fs::FS& fs, const char* basePath) {
+  if (!basePath || strlen(basePath) + 5 > kPersistPathMax) {
+    NFC_LOGE("ERROR: persistence base path too long!");
+    return false;
+  }
+  
+  NFCLockGuard<NFCPersistLock> persistLock(persistMutex);
+  DbWriteLock lock(*this);
+  persistFs = nullptr; // nothing is journaled while restoring
+  snprintf(snapshotPath, sizeof(snapshotPath), "%s.snp", basePath);
+  snprintf(snapshotTmpPath, sizeof(snapshotTmpPath), "%s.tmp", basePath);
+  snprintf(journalPath, sizeof(journalPath), "%s.jnl", basePath);
+  
+  resetStorageLocked();
+  // The changefeed sees the restore as a clear followed by the restored adds
+  recordChangeLocked(BuildingChange::Cleared, CardUid(), 0);
+  pendingJournalCount = 0;
+  journalRecords = 0;
+  
+  bool ok = true;
+  bool rewrite = false;
+  uint32_t generation = 0;
+  if (fs.exists(snapshotPath)) {
+    ok = loadSnapshotLocked(fs, snapshotPath, generation);
+  } else if (fs.exists(snapshotTmpPath)) {
+    // Power was lost between removing the old snapshot and renaming the new one
+    ok = loadSnapshotLocked(fs, snapshotTmpPath, generation);
+    rewrite = true;
+  }
+  
+  if (!ok) {
+    // Without a trustworthy snapshot the journal has nothing to apply to
+    NFC_LOGW("Stored registry snapshot is corrupt; starting empty");
+    resetStorageLocked();
+    rewrite = true;
+  } else if (fs.exists(journalPath) && !replayJournalLocked(fs, generation, journalRecords)) {
+    rewrite = true; // stale generation or torn tail - fold into a new snapshot
+  }
+  
+  persistGeneration = generation;
+  persistFs = &fs;
+  snapshotDue = false;
+  if (rewrite && !writeSnapshotLocked()) {
+    snapshotDue = true;
+  }
+  NFC_LOGI("Registry restored: %u buildings", (unsigned)buildingCount);
+  return ok;
+}
+
+bool NFCBuildingRegistry::saveSnapshot() {
+  if (!persistFs) {
+    return false;
+  }
+  NFCLockGuard<NFCPersistLock> persistLock(persistMutex);
+  NFCLockGuard<NFCRegistryLock> lock(dbMutex);
+  return writeSnapshotLocked();
+}
+
+bool NFCBuildingRegistry::isPersistenceEnabled() const {
+  return persistFs != nullptr;
+}
+
+void NFCBuildingRegistry::journalLocked(uint8_t op, const CardUid& uid, uint8_t buildingType) {
+  if (!persistFs || snapshotDue) {
+    return; // the next snapshot captures everything anyway
+  }
+  if (pendingJournalCount == kJournalPending) {
+    snapshotDue = true;
+    return;
+  }
+  JournalRecord& record = pendingJournal[pendingJournalCount++];
+  record.op = op;
+  record.buildingType = buildingType;
+  record.uid = uid;
+}
+
+void NFCBuildingRegistry::persistChanges() {
+  if (!persistFs) {
+    return;
+  }
+  
+  // persistMutex keeps batches in the order they were taken from pendingJournal
+  NFCLockGuard<NFCPersistLock> persistLock(persistMutex);
+  JournalRecord batch[kJournalPending];
+  size_t count;
+  {
+    NFCLockGuard<NFCRegistryLock> lock(dbMutex);
+    if (snapshotDue || journalRecords + pendingJournalCount > kJournalMaxRecords) {
+      // Compaction: bounds journal size, and with it the replay time and wear
+      if (!writeSnapshotLocked()) {
+        snapshotDue = true;
+      }
+      return;
+    }
+    count = pendingJournalCount;
+    memcpy(batch, pendingJournal, count * sizeof(JournalRecord));
+    pendingJournalCount = 0;
+  }
+  
+  if (count > 0 && !appendJournal(batch, count)) {
+    // A partly written record would hide everything appended after it
+    NFCLockGuard<NFCRegistryLock> lock(dbMutex);
+    if (!writeSnapshotLocked()) {
+      snapshotDue = true;
+    }
+  }
+}
+
+bool NFCBuildingRegistry::writeSnapshotLocked() {
+  File file = persistFs->open(snapshotTmpPath, "w");
+  if (!file) {
+    NFC_LOGE("ERROR: cannot create %s", snapshotTmpPath);
+    return false;
+  }
+  
+  const uint32_t generation = persistGeneration + 1;
+  uint8_t buf[9];
+  NFCCrcPrint out(file);
+  putHeader(buf, kSnapshotMagic, generation);
+  out.write(buf, 9);
+  serializeLocked(out);
+  putU32(buf, out.crc);
+  bool ok = !out.failed && file.write(buf, 4) == 4;
+  file.close();
+  if (!ok) {
+    NFC_LOGE("ERROR: registry snapshot write failed");
+    persistFs->remove(snapshotTmpPath);
+    return false;
+  }
+  
+  // Not every filesystem can rename over an existing file. From here on the
+  // new snapshot is authoritative (begin() falls back to the .tmp file), so
+  // the old journal is dropped and a new generation starts either way.
+  persistFs->remove(snapshotPath);
+  bool renamed = persistFs->rename(snapshotTmpPath, snapshotPath);
+  persistFs->remove(journalPath);
+  persistGeneration = generation;
+  journalRecords = 0;
+  pendingJournalCount = 0;
+  snapshotDue = false;
+  return renamed;
+}
+
+bool NFCBuildingRegistry::appendJournal(const JournalRecord* records, size_t count) {
+  // An empty journal is recreated with the current generation in its header
+  File file = persistFs->open(journalPath, journalRecords == 0 ? "w" : "a");
+  if (!file) {
+    return false;
+  }
+  
+  uint8_t buf[2 + NFC_UID_MAX_BYTES + 2];
+  bool ok = true;
+  if (journalRecords == 0) {
+    putHeader(buf, kJournalMagic, persistGeneration);
+    ok = file.write(buf, 9) == 9;
+  }
+  for (size_t i = 0; ok && i < count; i++) {
+    const JournalRecord& record = records[i];
+    size_t n = 0;
+    buf[n++] = record.op;
+    buf[n++] = record.uid.len;
+    memcpy(buf + n, record.uid.bytes, record.uid.len);
+    n += record.uid.len;
+    buf[n++] = record.buildingType;
+    buf[n] = crc8(buf, n);
+    n++;
+    ok = file.write(buf, n) == n;
+  }
+  file.close();
+  journalRecords += count;
+  return ok;
+}
+
+bool NFCBuildingRegistry::loadSnapshotLocked(fs::FS& fs, const char* path, uint32_t& generation) {
+  File file = fs.open(path, "r");
+  if (!file) {
+    return false;
+  }
+  
+  uint8_t buf[9];
+  NFCCrcStream in(file);
+  bool dropped = false;
+  if (in.readBytes(reinterpret_cast<char*>(buf), 9) != 9 || !checkHeader(buf, kSnapshotMagic) ||
+      !deserializeLocked(in, nullptr, dropped)) {
+    return false;
+  }
+  if (dropped) {
+    NFC_LOGW("Stored registry holds more cards than NFC_REGISTRY_MAX_CARDS; extra cards dropped");
+  }
+  uint32_t fileGeneration = getU32(buf + 5);
+  if (file.read(buf, 4) != 4 || getU32(buf) != in.crc) {
+    return false;
+  }
+  sortLruLocked();
+  generation = fileGeneration;
+  return true;
+}
+
+bool NFCBuildingRegistry::replayJournalLocked(fs::FS& fs, uint32_t generation, size_t& records) {
+  File file = fs.open(journalPath, "r");
+  if (!file) {
+    return false;
+  }
+  
+  uint8_t buf[2 + NFC_UID_MAX_BYTES + 2];
+  if (file.read(buf, 9) != 9 || !checkHeader(buf, kJournalMagic) || getU32(buf + 5) != generation) {
+    return false; // written against an older snapshot that already contains it
+  }
+  
+  records = 0;
+  for (;;) {
+    size_t got = file.read(buf, 2);
+    if (got == 0) {
+      return true; // clean end of journal
+    }
+    if (got != 2 || buf[0] < JournalAdd || buf[0] > JournalClear || buf[1] > NFC_UID_MAX_BYTES) {
+      return false;
+    }
+    size_t rest = buf[1] + 2;
+    if (file.read(buf + 2, rest) != rest || crc8(buf, 2 + buf[1] + 1) != buf[2 + buf[1] + 1]) {
+      return false; // torn write at power loss
+    }
+    
+    CardUid uid;
+    uid.len = buf[1];
+    memcpy(uid.bytes, buf + 2, uid.len);
+    uint8_t buildingType = buf[2 + uid.len];
+    if (buf[0] == JournalAdd) {
+      if (uid.len) {
+        bool inserted;
+        findOrInsertLocked(uid, buildingType, inserted);
+      }
+    } else if (buf[0] == JournalRemove) {
+      size_t pos = findIndexPos(uid);
+      if (pos != kIndexSize) {
+        eraseAtLocked(pos);
+      }
+    } else {
+      resetStorageLocked();
+    }
+    records++;
+  }
+}
+
+#endif // NFC_REGISTRY_PERSISTENCE
@@ -0,0 +1,543 @@
+#include "NFCRegistryReplication.h"
+
+#if NFC_REGISTRY_REPLICATION
+
+#include "NFCRegistryLog.h"
+#if defined(ESP8266)
+  #include <ESP8266WiFi.h>
+  #include <espnow.h>
+#elif defined(ESP32)
+  #include <WiFi.h>
+  #include <esp_now.h>
+  #if __has_include(<esp_random.h>)
+    #include <esp_random.h>
+  #endif
+  #if __has_include(<esp_idf_version.h>)
+    #include <esp_idf_version.h>
+  #endif
+#endif
+
+// Packet layout (integers little-endian, at most 250 bytes):
+//   header: 'N' 'R' | version | flags | node u32 | session u16 | seq u32 |
+//           sender clock u32 | count
+//   count x (op | clock u32 | type | uidLen | uid)
+// seq increases by one per packet and session is random per boot, so
+// receivers drop duplicates and count gaps. Each change carries the Lamport
+// clock of its write; (clock, node) orders writes to the same UID.
+
+constexpr size_t NFCRegistryReplicator::kMaxPacket;
+constexpr size_t NFCRegistryReplicator::kHeaderSize;
+constexpr size_t NFCRegistryReplicator::kInboxSize;
+constexpr size_t NFCRegistryReplicator::kMaxEntries;
+constexpr size_t NFCRegistryReplicator::kMaxPeers;
+constexpr size_t NFCRegistryReplicator::kEntryIndexSize;
+constexpr uint16_t NFCRegistryReplicator::kNoEntry;
+
+static const uint8_t kPacketMagic[2] = {'N', 'R'};
+static const uint8_t kProtocolVersion = 1;
+static const size_t kChangeHeaderSize = 7; // op, clock, type, uidLen
+static const uint8_t kBroadcast[6] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+
+NFCRegistryReplicator* NFCRegistryReplicator::instance = nullptr;
+
+static void putU32(uint8_t* out, uint32_t value) {
+  out[0] = static_cast<uint8_t>(value);
+  out[1] = static_cast<uint8_t>(value >> 8);
+  out[2] = static_cast<uint8_t>(value >> 16);
+  out[3] = static_cast<uint8_t>(value >> 24);
+}
+
+static uint32_t getU32(const uint8_t* in) {
+  return static_cast<uint32_t>(in[0]) | (static_cast<uint32_t>(in[1]) << 8) |
+         (static_cast<uint32_t>(in[2]) << 16) | (static_cast<uint32_t>(in[3]) << 24);
+}
+
+// ESP-NOW receive callbacks (WiFi task); the signature changed with ESP-IDF 5
+#if defined(ESP8266)
+static void onEspNowReceive(uint8_t* mac, uint8_t* data, uint8_t length) {
+  (void)mac;
+  NFCRegistryReplicator::receivePacket(data, length);
+}
+#elif defined(ESP_IDF_VERSION_MAJOR) && ESP_IDF_VERSION_MAJOR >= 5
+static void onEspNowReceive(const esp_now_recv_info_t* info, const uint8_t* data, int length) {
+  (void)info;
+  NFCRegistryReplicator::receivePacket(data, length > 0 ? static_cast<size_t>(length) : 0);
+}
+#else
+static void onEspNowReceive(const uint8_t* mac, const uint8_t* data, int length) {
+  (void)mac;
+  NFCRegistryReplicator::receivePacket(data, length > 0 ? static_cast<size_t>(length) : 0);
+}
+#endif
+
+NFCRegistryReplicator::NFCRegistryReplicator(NFCBuildingRegistry& registry)
+  : registry(registry), running(false), nodeId(0), session(0), sequence(0),
+    lamport(0), sentVersion(0), floorClock(0), floorNode(0), replyHello(false),
+    entries(), entryCount(0), peers(), peerCount(0), outLength(0), outCount(0), stats(), overruns(0) {
+  clearEntries();
+}
+
+NFCRegistryReplicator::~NFCRegistryReplicator() {
+  end();
+}
+
+bool NFCRegistryReplicator::begin(uint32_t id) {
+  if (running) {
+    return true;
+  }
+  if (instance) {
+    NFC_LOGE("Replication: another replicator is running");
+    return false;
+  }
+  if (id == 0) {
+    uint8_t mac[6];
+    WiFi.macAddress(mac);
+    id = getU32(mac + 2);
+    if (id == 0) {
+      id = 1;
+    }
+  }
+
+#if defined(ESP8266)
+  if (esp_now_init() != 0) {
+    NFC_LOGE("Replication: esp_now_init failed");
+    return false;
+  }
+  esp_now_set_self_role(ESP_NOW_ROLE_COMBO);
+  esp_now_add_peer(const_cast<uint8_t*>(kBroadcast), ESP_NOW_ROLE_COMBO, 0, nullptr, 0);
+  session = static_cast<uint16_t>(ESP.random());
+#elif defined(ESP32)
+  if (esp_now_init() != ESP_OK) {
+    NFC_LOGE("Replication: esp_now_init failed");
+    return false;
+  }
+  if (!esp_now_is_peer_exist(kBroadcast)) {
+    esp_now_peer_info_t peer = {};
+    memcpy(peer.peer_addr, kBroadcast, sizeof(kBroadcast));
+    peer.channel = 0; // current channel
+    peer.ifidx = WIFI_IF_STA;
+    peer.encrypt = false;
+    if (esp_now_add_peer(&peer) != ESP_OK) {
+      NFC_LOGE("Replication: adding the broadcast peer failed");
+      return false;
+    }
+  }
+  session = static_cast<uint16_t>(esp_random());
+#endif
+
+  // Drop whatever the previous run left behind
+  Packet stale;
+  while (inbox.pop(stale)) {
+  }
+  nodeId = id;
+  sequence = 0;
+  sentVersion = registry.getVersion();
+  clearEntries();
+  peerCount = 0;
+  outLength = 0;
+  outCount = 0;
+  replyHello = false;
+  instance = this;
+  running = true;
+  esp_now_register_recv_cb(onEspNowReceive);
+  NFC_LOGI("Replication: node %08lX started", static_cast<unsigned long>(nodeId));
+
+  // Peers answer the hello with their clock, so writes made after a reboot
+  // are not ordered before the writes this node has forgotten
+  outLength = kHeaderSize;
+  out[3] = FlagHello;
+  flush();
+  return true;
+}
+
+void NFCRegistryReplicator::end() {
+  if (!running) {
+    return;
+  }
+  esp_now_unregister_recv_cb();
+#if defined(ESP8266)
+  esp_now_del_peer(const_cast<uint8_t*>(kBroadcast));
+#elif defined(ESP32)
+  esp_now_del_peer(kBroadcast);
+#endif
+  running = false;
+  instance = nullptr;
+}
+
+bool NFCRegistryReplicator::isRunning() const {
+  return running;
+}
+
+uint32_t NFCRegistryReplicator::getNodeId() const {
+  return nodeId;
+}
+
+uint32_t NFCRegistryReplicator::getClock() const {
+  return lamport;
+}
+
+void NFCRegistryReplicator::getStats(NFCReplicationStats& result) const {
+  result = stats;
+  result.receiveOverruns = overruns.load(std::memory_order_relaxed);
+}
+
+void NFCRegistryReplicator::receivePacket(const uint8_t* data, size_t length) {
+  NFCRegistryReplicator* self = instance;
+  if (!self || !data || length == 0 || length > kMaxPacket) {
+    return;
+  }
+  Packet packet;
+  packet.length = static_cast<uint8_t>(length);
+  memcpy(packet.data, data, length);
+  if (!self->inbox.push(packet)) {
+    self->overruns.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+void NFCRegistryReplicator::update() {
+  if (!running) {
+    return;
+  }
+  // Local changes go out before remote ones are applied, so every change
+  // the feed holds at this point is a local one or an echo counted earlier
+  sendLocalChanges();
+
+  Packet packet;
+  while (inbox.pop(packet)) {
+    handlePacket(packet.data, packet.length);
+  }
+  if (replyHello) {
+    replyHello = false;
+    outLength = kHeaderSize;
+    outCount = 0;
+    flush();
+  }
+}
+
+void NFCRegistryReplicator::sendLocalChanges() {
+  BuildingChange changes[16];
+  ChangeFeedStatus status;
+  do {
+    size_t count = 0;
+    status = registry.changesSince(sentVersion, changes, 16, count);
+    if (status == ChangeFeedStatus::ResyncRequired) {
+      // The changes are gone; peers keep their state until a full resync
+      stats.resyncs++;
+      NFC_LOGW("Replication: changefeed overflow, local changes not sent");
+      sentVersion = registry.getVersion();
+      for (size_t i = 0; i < entryCount; i++) {
+        entries[i].echoes = 0;
+      }
+      break;
+    }
+    for (size_t i = 0; i < count; i++) {
+      const BuildingChange& change = changes[i];
+      sentVersion = change.version;
+      if (change.type == BuildingChange::Cleared) {
+        const uint32_t clock = ++lamport;
+        floorClock = clock;
+        floorNode = nodeId;
+        clearEntries(); // every write so far is void
+        queueChange(OpClear, clock, 0, change.uid);
+        continue;
+      }
+      Entry* entry = findEntry(change.uid);
+      if (entry && entry->echoes) {
+        entry->echoes--; // caused by applyRemote(), the peers know it
+        continue;
+      }
+      if (!entry) {
+        entry = insertEntry(change.uid);
+      }
+      entry->clock = ++lamport;
+      entry->node = nodeId;
+      queueChange(change.type == BuildingChange::Added ? OpAdd : OpRemove,
+                  entry->clock, change.buildingType, change.uid);
+    }
+  } while (status == ChangeFeedStatus::More);
+  if (outCount) {
+    flush();
+  }
+}
+
+void NFCRegistryReplicator::queueChange(uint8_t op, uint32_t clock, uint8_t buildingType, const CardUid& uid) {
+  const uint8_t uidLen = op == OpClear ? 0 : uid.len;
+  if (outLength + kChangeHeaderSize + uidLen > kMaxPacket || outCount == 255) {
+    flush();
+  }
+  if (outLength == 0) {
+    outLength = kHeaderSize;
+  }
+  uint8_t* p = out + outLength;
+  p[0] = op;
+  putU32(p + 1, clock);
+  p[5] = buildingType;
+  p[6] = uidLen;
+  memcpy(p + kChangeHeaderSize, uid.bytes, uidLen);
+  outLength += kChangeHeaderSize + uidLen;
+  outCount++;
+  stats.changesSent++;
+}
+
+// Sends the assembled packet (header filled in here, flags preset in out[3])
+void NFCRegistryReplicator::flush() {
+  if (outLength < kHeaderSize) {
+    return;
+  }
+  out[0] = kPacketMagic[0];
+  out[1] = kPacketMagic[1];
+  out[2] = kProtocolVersion;
+  putU32(out + 4, nodeId);
+  out[8] = static_cast<uint8_t>(session);
+  out[9] = static_cast<uint8_t>(session >> 8);
+  putU32(out + 10, ++sequence);
+  putU32(out + 14, lamport);
+  out[18] = outCount;
+  if (sendPacket(out, outLength)) {
+    stats.packetsSent++;
+  } else {
+    stats.sendFailures++;
+  }
+  outLength = 0;
+  outCount = 0;
+  out[3] = 0;
+}
+
+bool NFCRegistryReplicator::sendPacket(const uint8_t* data, size_t length) {
+#if defined(ESP8266)
+  return esp_now_send(const_cast<uint8_t*>(kBroadcast), const_cast<uint8_t*>(data), length) == 0;
+#else
+  return esp_now_send(kBroadcast, data, length) == ESP_OK;
+#endif
+}
+
+void NFCRegistryReplicator::handlePacket(const uint8_t* data, size_t length) {
+  if (length < kHeaderSize || data[0] != kPacketMagic[0] || data[1] != kPacketMagic[1] ||
+      data[2] != kProtocolVersion) {
+    stats.malformed++;
+    return;
+  }
+  const uint32_t node = getU32(data + 4);
+  if (node == nodeId) {
+    return;
+  }
+  const uint16_t peerSession = static_cast<uint16_t>(data[8] | (data[9] << 8));
+  if (!acceptSequence(node, peerSession, getU32(data + 10))) {
+    stats.duplicates++;
+    return;
+  }
+  stats.packetsReceived++;
+  const uint32_t senderClock = getU32(data + 14);
+  if (senderClock > lamport) {
+    lamport = senderClock;
+  }
+  if (data[3] & FlagHello) {
+    replyHello = true;
+  }
+
+  size_t pos = kHeaderSize;
+  for (uint8_t i = 0; i < data[18]; i++) {
+    if (pos + kChangeHeaderSize > length) {
+      stats.malformed++;
+      return;
+    }
+    const uint8_t* p = data + pos;
+    const uint8_t uidLen = p[6];
+    CardUid uid = CardUid();
+    if (pos + kChangeHeaderSize + uidLen > length ||
+        (p[0] != OpClear && !CardUid::fromBytes(p + kChangeHeaderSize, uidLen, uid))) {
+      stats.malformed++;
+      return;
+    }
+    applyRemote(p[0], getU32(p + 1), node, p[5], uid);
+    pos += kChangeHeaderSize + uidLen;
+  }
+}
+
+// Returns false for packets already seen; counts skipped sequence numbers as lost
+bool NFCRegistryReplicator::acceptSequence(uint32_t node, uint16_t peerSession, uint32_t seq) {
+  Peer* peer = nullptr;
+  for (size_t i = 0; i < peerCount; i++) {
+    if (peers[i].node == node) {
+      peer = &peers[i];
+      break;
+    }
+  }
+  if (!peer) {
+    if (peerCount < kMaxPeers) {
+      peer = &peers[peerCount++];
+    } else {
+      // Unknown peers replace the one with the lowest node id when full
+      peer = &peers[0];
+      for (size_t i = 1; i < kMaxPeers; i++) {
+        if (peers[i].node < peer->node) {
+          peer = &peers[i];
+        }
+      }
+    }
+    peer->node = node;
+    peer->session = peerSession;
+    peer->lastSeq = seq;
+    return true;
+  }
+  if (peer->session != peerSession) {
+    peer->session = peerSession; // peer restarted
+    peer->lastSeq = seq;
+    return true;
+  }
+  const int32_t ahead = static_cast<int32_t>(seq - peer->lastSeq);
+  if (ahead <= 0) {
+    return false;
+  }
+  stats.packetsLost += static_cast<uint32_t>(ahead - 1);
+  peer->lastSeq = seq;
+  return true;
+}
+
+void NFCRegistryReplicator::applyRemote(uint8_t op, uint32_t clock, uint32_t node,
+                                        uint8_t buildingType, const CardUid& uid) {
+  if (clock > lamport) {
+    lamport = clock;
+  }
+  if (op == OpClear) {
+    applyRemoteClear(clock, node);
+    return;
+  }
+  if (op != OpAdd && op != OpRemove) {
+    stats.malformed++;
+    return;
+  }
+  Entry* entry = findEntry(uid);
+  const bool newer = entry ? isNewer(clock, node, entry->clock, entry->node)
+                           : isNewer(clock, node, floorClock, floorNode);
+  if (!newer) {
+    stats.conflictsLost++;
+    return;
+  }
+  if (!entry) {
+    entry = insertEntry(uid);
+  }
+  entry->clock = clock;
+  entry->node = node;
+  stats.changesApplied++;
+
+  // Through the batch calls, which report the changes to the registry
+  // callbacks (reader NoReader) and return how many the feed will echo
+  if (op == OpRemove) {
+    entry->echoes += static_cast<uint8_t>(registry.removeBuildings(&uid, 1));
+    return;
+  }
+  // A copy read under the registry's lock: with the scanner task running, the
+  // slot behind a getBuilding() pointer may be freed or reused meanwhile
+  const BuildingEntry added = {uid, buildingType};
+  BuildingCard card;
+  if (!registry.readBuilding(registry.getBuildingHandle(uid), card)) {
+    entry->echoes += static_cast<uint8_t>(registry.addBuildings(&added, 1));
+  } else if (card.buildingType != buildingType) {
+    // Retype: one removal plus one addition, like a rewritten tag
+    entry->echoes += static_cast<uint8_t>(registry.applyDelta(&added, 1, &uid, 1));
+  }
+}
+
+void NFCRegistryReplicator::applyRemoteClear(uint32_t clock, uint32_t node) {
+  if (!isNewer(clock, node, floorClock, floorNode)) {
+    stats.conflictsLost++;
+    return;
+  }
+  floorClock = clock;
+  floorNode = node;
+  stats.changesApplied++;
+  // Cards written after the clear (on any node) survive it. One call per
+  // card, so each one's echo is counted against its own entry.
+  const std::vector<BuildingCard> cards = registry.snapshotBuildings();
+  for (const BuildingCard& card : cards) {
+    Entry* entry = findEntry(card.uid);
+    if (entry && isNewer(entry->clock, entry->node, clock, node)) {
+      continue;
+    }
+    if (!entry) {
+      entry = insertEntry(card.uid);
+    }
+    entry->clock = clock;
+    entry->node = node;
+    entry->echoes += static_cast<uint8_t>(registry.removeBuildings(&card.uid, 1));
+  }
+}
+
+NFCRegistryReplicator::Entry* NFCRegistryReplicator::findEntry(const CardUid& uid) {
+  const size_t pos = findEntryPos(uid);
+  return pos != kEntryIndexSize ? &entries[entryIndex[pos]] : nullptr;
+}
+
+NFCRegistryReplicator::Entry* NFCRegistryReplicator::insertEntry(const CardUid& uid) {
+  Entry* entry;
+  if (entryCount < kMaxEntries) {
+    entry = &entries[entryCount++];
+  } else {
+    // Forgetting the oldest write only matters if a still older one arrives
+    entry = &entries[0];
+    for (size_t i = 1; i < kMaxEntries; i++) {
+      if (isNewer(entry->clock, entry->node, entries[i].clock, entries[i].node)) {
+        entry = &entries[i];
+      }
+    }
+    unindexEntry(findEntryPos(entry->uid));
+  }
+  size_t pos = hashUid(uid);
+  while (entryIndex[pos] != kNoEntry) {
+    pos = (pos + 1) & (kEntryIndexSize - 1);
+  }
+  entryIndex[pos] = static_cast<uint16_t>(entry - entries);
+  entry->uid = uid;
+  entry->echoes = 0;
+  entry->clock = floorClock;
+  entry->node = floorNode;
+  return entry;
+}
+
+size_t NFCRegistryReplicator::findEntryPos(const CardUid& uid) const {
+  size_t pos = hashUid(uid);
+  while (entryIndex[pos] != kNoEntry) {
+    if (entries[entryIndex[pos]].uid == uid) {
+      return pos;
+    }
+    pos = (pos + 1) & (kEntryIndexSize - 1);
+  }
+  return kEntryIndexSize;
+}
+
+void NFCRegistryReplicator::unindexEntry(size_t pos) {
+  // Backward-shift deletion, as in the registry's index
+  const size_t mask = kEntryIndexSize - 1;
+  size_t hole = pos;
+  for (;;) {
+    pos = (pos + 1) & mask;
+    if (entryIndex[pos] == kNoEntry) {
+      break;
+    }
+    const size_t home = hashUid(entries[entryIndex[pos]].uid);
+    if (((pos - home) & mask) >= ((pos - hole) & mask)) {
+      entryIndex[hole] = entryIndex[pos];
+      hole = pos;
+    }
+  }
+  entryIndex[hole] = kNoEntry;
+}
+
+void NFCRegistryReplicator::clearEntries() {
+  entryCount = 0;
+  for (size_t i = 0; i < kEntryIndexSize; i++) {
+    entryIndex[i] = kNoEntry;
+  }
+}
+
+size_t NFCRegistryReplicator::hashUid(const CardUid& uid) {
+  // FNV-1a over the raw UID bytes
+  uint32_t h = 2166136261u;
+  for (uint8_t i = 0; i < uid.len; i++) {
+    h = (h ^ uid.bytes[i]) * 16777619u;
+  }
+  return h & (kEntryIndexSize - 1);
+}
+
+#endif // NFC_REGISTRY_REPLICATION
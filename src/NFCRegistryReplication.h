@@ -0,0 +1,154 @@
+#ifndef NFC_REGISTRY_REPLICATION_H
+#define NFC_REGISTRY_REPLICATION_H
+
+#include "NFCBuildingRegistry.h"
+
+// Replication of one registry to the registries of other devices over
+// ESP-NOW broadcast. Define NFC_REGISTRY_REPLICATION=0 to leave it out.
+#ifndef NFC_REGISTRY_REPLICATION
+  #define NFC_REGISTRY_REPLICATION 1
+#endif
+
+#if NFC_REGISTRY_REPLICATION
+
+// UIDs whose last write is remembered for conflict resolution (cards and
+// recent removals). When full, the entry with the oldest write is reused.
+#ifndef NFC_REPLICATION_MAX_ENTRIES
+  #define NFC_REPLICATION_MAX_ENTRIES NFC_REGISTRY_MAX_CARDS
+#endif
+
+// Peers whose packet sequence numbers are tracked
+#ifndef NFC_REPLICATION_MAX_PEERS
+  #define NFC_REPLICATION_MAX_PEERS 8
+#endif
+
+struct NFCReplicationStats {
+  uint32_t packetsSent;
+  uint32_t packetsReceived;
+  uint32_t changesSent;
+  uint32_t changesApplied;  // remote changes that won and were applied
+  uint32_t conflictsLost;   // remote changes older than the local write, ignored
+  uint32_t packetsLost;     // gaps in a peer's sequence numbers
+  uint32_t duplicates;      // repeated or reordered packets, dropped
+  uint32_t resyncs;         // local changefeed overflowed, changes were not sent
+  uint32_t sendFailures;
+  uint32_t receiveOverruns; // packets dropped because update() ran too rarely
+  uint32_t malformed;
+};
+
+// Broadcasts the registry's add/remove/clear changes (read from its
+// changefeed) in batched packets and applies the changes of peers.
+// Conflicts are resolved per UID by last writer wins on a Lamport clock,
+// ties broken by node id, so all nodes converge on the same state. Only
+// changes are sent; a node that joins late or loses packets (packetsLost)
+// needs a full resync, e.g. serialize()/deserialize() from a peer.
+// One replicator per device (ESP-NOW callbacks carry no context).
+class NFCRegistryReplicator {
+public:
+  explicit NFCRegistryReplicator(NFCBuildingRegistry& registry);
+  ~NFCRegistryReplicator();
+
+  // Starts ESP-NOW on the current WiFi channel; put WiFi in station mode
+  // first (WiFi.mode(WIFI_STA)), all nodes must share the channel. nodeId 0
+  // derives the id from the MAC address. Changes made before begin() are
+  // not sent. Returns false if ESP-NOW could not be started or another
+  // replicator is running.
+  bool begin(uint32_t nodeId = 0);
+  void end();
+  bool isRunning() const;
+
+  // Sends pending local changes, then applies received ones (invoking the
+  // registry callbacks with reader BuildingEvent::NoReader). Call from loop().
+  void update();
+
+  uint32_t getNodeId() const;
+  uint32_t getClock() const;
+  void getStats(NFCReplicationStats& out) const;
+
+  // Queues one received packet for update(). Called by the ESP-NOW receive
+  // callback (WiFi task); safe to call from one other task or transport.
+  static void receivePacket(const uint8_t* data, size_t length);
+
+private:
+  static constexpr size_t kMaxPacket = 250; // ESP-NOW payload limit
+  static constexpr size_t kHeaderSize = 19;
+  static constexpr size_t kInboxSize = 8;   // power of two
+  static constexpr size_t kMaxEntries = NFC_REPLICATION_MAX_ENTRIES;
+  // Hash index over the entries, sized like the registry's (load factor <= 0.5)
+  static constexpr size_t kEntryIndexSize = nfcNextPow2(kMaxEntries * 2);
+  static constexpr uint16_t kNoEntry = 0xFFFF;
+  static_assert(kMaxEntries > 0 && kMaxEntries < kNoEntry, "NFC_REPLICATION_MAX_ENTRIES must be in 1..65534");
+  static constexpr size_t kMaxPeers = NFC_REPLICATION_MAX_PEERS;
+
+  enum Op : uint8_t { OpAdd = 1, OpRemove = 2, OpClear = 3 };
+  enum Flags : uint8_t { FlagHello = 0x01 }; // sender just started: peers reply with their clock
+
+  struct Packet {
+    uint8_t length;
+    uint8_t data[kMaxPacket];
+  };
+  // Last write of one UID; echoes counts the registry changes caused by
+  // applying remote writes, which must not be sent back out
+  struct Entry {
+    CardUid uid;
+    uint8_t echoes;
+    uint32_t clock;
+    uint32_t node;
+  };
+  struct Peer {
+    uint32_t node;
+    uint16_t session; // random per boot, so a restarted peer's sequence is accepted
+    uint32_t lastSeq;
+  };
+
+  NFCBuildingRegistry& registry;
+  bool running;
+  uint32_t nodeId;
+  uint16_t session;
+  uint32_t sequence;
+  uint32_t lamport;          // Lamport clock: above every write seen so far
+  uint32_t sentVersion;      // registry version handled by update()
+  uint32_t floorClock;       // last clear: writes up to it are void
+  uint32_t floorNode;
+  bool replyHello;
+  Entry entries[kMaxEntries];
+  size_t entryCount;
+  uint16_t entryIndex[kEntryIndexSize]; // hash position -> entry, kNoEntry when empty
+  Peer peers[kMaxPeers];
+  size_t peerCount;
+  uint8_t out[kMaxPacket];   // packet being assembled
+  size_t outLength;
+  uint8_t outCount;
+  NFCReplicationStats stats;
+  NFCEventRing<Packet, kInboxSize> inbox;
+  std::atomic<uint32_t> overruns;
+
+  static NFCRegistryReplicator* instance;
+
+  void sendLocalChanges();
+  void queueChange(uint8_t op, uint32_t clock, uint8_t buildingType, const CardUid& uid);
+  void flush();
+  bool sendPacket(const uint8_t* data, size_t length);
+  void handlePacket(const uint8_t* data, size_t length);
+  bool acceptSequence(uint32_t node, uint16_t peerSession, uint32_t seq);
+  void applyRemote(uint8_t op, uint32_t clock, uint32_t node, uint8_t buildingType, const CardUid& uid);
+  void applyRemoteClear(uint32_t clock, uint32_t node);
+  Entry* findEntry(const CardUid& uid);
+  Entry* insertEntry(const CardUid& uid); // reuses the oldest entry when full
+  size_t findEntryPos(const CardUid& uid) const; // kEntryIndexSize if not found
+  void unindexEntry(size_t pos);
+  void clearEntries();
+  static size_t hashUid(const CardUid& uid);
+
+  // Last writer wins: higher clock, then higher node id
+  static bool isNewer(uint32_t clock, uint32_t node, uint32_t otherClock, uint32_t otherNode) {
+    return clock != otherClock ? clock > otherClock : node > otherNode;
+  }
+
+  NFCRegistryReplicator(const NFCRegistryReplicator&) = delete;
+  NFCRegistryReplicator& operator=(const NFCRegistryReplicator&) = delete;
+};
+
+#endif // NFC_REGISTRY_REPLICATION
+
+#endif // NFC_REGISTRY_REPLICATION_H
@@ -0,0 +1,193 @@
+#include "NFCBuildingRegistry.h"
+#include "NFCRegistryLog.h"
+
+// Registry wire format, used for network sync and as the body of the flash
+// snapshot:
+//   'N' 'F' 'B' | format version | varint registry version | varint count |
+//   count x (uidLen | uid | type | varint lastSeen age | varint firstSeen - lastSeen)
+// Varints are unsigned LEB128. Ages are milliseconds before serialization,
+// so a 4-byte UID card typically takes 8-10 bytes.
+
+static const uint8_t kWireMagic[3] = {'N', 'F', 'B'};
+static const uint8_t kWireVersion = 1;
+
+static size_t putVarint(uint8_t* out, uint32_t value) {
+  size_t n = 0;
+  while (value >= 0x80) {
+    out[n++] = static_cast<uint8_t>(value | 0x80);
+    value >>= 7;
+  }
+  out[n++] = static_cast<uint8_t>(value);
+  return n;
+}
+
+static bool readByte(Stream& in, uint8_t& out) {
+  return in.readBytes(reinterpret_cast<char*>(&out), 1) == 1;
+}
+
+static bool readVarint(Stream& in, uint32_t& out) {
+  out = 0;
+  for (uint8_t shift = 0; shift < 35; shift += 7) {
+    uint8_t b;
+    if (!readByte(in, b)) {
+      return false;
+    }
+    out |= static_cast<uint32_t>(b & 0x7F) << shift;
+    if (!(b & 0x80)) {
+      return true;
+    }
+  }
+  return false; // longer than 5 bytes
+}
+
+// Computed in the timestamp domain: shortly after boot now - ageMs would wrap
+// millis() and no longer map onto the same timestamp counter
+static NFCTimestamp stampFromAge(unsigned long now, uint32_t ageMs) {
+  return static_cast<NFCTimestamp>(nfcTimestamp(now) - ageMs / NFC_REGISTRY_TIMESTAMP_RESOLUTION_MS);
+}
+
+// Print into a caller buffer; counts (but drops) bytes beyond its size
+class NFCBufferPrint : public Print {
+public:
+  NFCBufferPrint(uint8_t* buffer, size_t size) : buffer(buffer), size(size), length(0) {}
+  size_t write(uint8_t b) override { return write(&b, 1); }
+  size_t write(const uint8_t* data, size_t count) override {
+    for (size_t i = 0; i < count; i++, length++) {
+      if (buffer && length < size) buffer[length] = data[i];
+    }
+    return count;
+  }
+  size_t written() const { return length; }
+  bool overflowed() const { return length > size; }
+private:
+  uint8_t* buffer;
+  size_t size;
+  size_t length;
+};
+
+// Stream over a caller buffer. No timeout: the end of the buffer is final,
+// and readBytes() must not wait for more while the lock is held.
+class NFCBufferStream : public Stream {
+public:
+  NFCBufferStream(const uint8_t* data, size_t size) : data(data), size(size), pos(0) {
+    setTimeout(0);
+  }
+  int available() override { return static_cast<int>(size - pos); }
+  int read() override { return pos < size ? data[pos++] : -1; }
+  int peek() override { return pos < size ? data[pos] : -1; }
+  size_t write(uint8_t) override { return 0; }
+private:
+  const uint8_t* data;
+  size_t size;
+  size_t pos;
+};
+
+size_t NFCBuildingRegistry::serializeLocked(Print& out) const {
+  uint8_t buf[1 + NFC_UID_MAX_BYTES + 1 + 10];
+  size_t n = 0;
+  memcpy(buf, kWireMagic, 3);
+  buf[3] = kWireVersion;
+  n = 4;
+  n += putVarint(buf + n, dbVersion.load(std::memory_order_relaxed));
+  n += putVarint(buf + n, static_cast<uint32_t>(buildingCount));
+  size_t total = out.write(buf, n);
+  if (total != n) {
+    return 0;
+  }
+  
+  const unsigned long now = millis();
+  for (size_t i = 0; i < kCapacity; i++) {
+    const BuildingCard& card = slots[i];
+    if (!card.uid.len) continue;
+    uint32_t lastAge = static_cast<uint32_t>(now - card.lastSeen());
+    uint32_t firstAge = static_cast<uint32_t>(now - card.firstSeen());
+    n = 0;
+    buf[n++] = card.uid.len;
+    memcpy(buf + n, card.uid.bytes, card.uid.len);
+    n += card.uid.len;
+    buf[n++] = card.buildingType;
+    n += putVarint(buf + n, lastAge);
+    n += putVarint(buf + n, firstAge >= lastAge ? firstAge - lastAge : 0);
+    if (out.write(buf, n) != n) {
+      return 0;
+    }
+    total += n;
+  }
+  return total;
+}
+
+bool NFCBuildingRegistry::deserializeLocked(Stream& in, uint32_t* version, bool& dropped) {
+  dropped = false;
+  uint8_t header[4];
+  if (in.readBytes(reinterpret_cast<char*>(header), 4) != 4 ||
+      memcmp(header, kWireMagic, 3) != 0 || header[3] != kWireVersion) {
+    return false;
+  }
+  uint32_t sourceVersion, count;
+  if (!readVarint(in, sourceVersion) || !readVarint(in, count)) {
+    return false;
+  }
+  
+  const unsigned long now = millis();
+  for (uint32_t i = 0; i < count; i++) {
+    CardUid uid;
+    uint8_t buildingType;
+    uint32_t lastAge, firstDelta;
+    if (!readByte(in, uid.len) || uid.len == 0 || uid.len > NFC_UID_MAX_BYTES ||
+        in.readBytes(reinterpret_cast<char*>(uid.bytes), uid.len) != uid.len ||
+        !readByte(in, buildingType) || !readVarint(in, lastAge) || !readVarint(in, firstDelta)) {
+      return false;
+    }
+    bool inserted;
+    BuildingCard* card = findOrInsertLocked(uid, buildingType, inserted);
+    if (!card) {
+      dropped = true; // more cards than NFC_REGISTRY_MAX_CARDS allows here
+      continue;
+    }
+    if (inserted) {
+      card->lastSeenStamp = stampFromAge(now, lastAge);
+      card->firstSeenStamp = stampFromAge(now, lastAge + firstDelta);
+    }
+  }
+  if (version) *version = sourceVersion;
+  return true;
+}
+
+size_t NFCBuildingRegistry::serialize(Print& out) const {
+  NFCLockGuard<NFCRegistryLock> lock(dbMutex);
+  return serializeLocked(out);
+}
+
+size_t NFCBuildingRegistry::serialize(uint8_t* buffer, size_t size) const {
+  NFCBufferPrint out(buffer, size);
+  serialize(out);
+  return out.overflowed() ? 0 : out.written();
+}
+
+size_t NFCBuildingRegistry::getSerializedSize() const {
+  NFCBufferPrint counter(nullptr, 0);
+  return serialize(counter);
+}
+
+bool NFCBuildingRegistry::deserialize(Stream& in, uint32_t* version) {
+  bool ok, dropped;
+  {
+    DbWriteLock lock(*this);
+    resetStorageLocked();
+    recordChangeLocked(BuildingChange::Cleared, CardUid(), 0);
+    ok = deserializeLocked(in, version, dropped);
+    sortLruLocked(); // restored ages come in storage order, not lastSeen order
+  }
+  if (dropped) {
+    NFC_LOGW("Serialized registry holds more cards than NFC_REGISTRY_MAX_CARDS; extra cards dropped");
+  }
+#if NFC_REGISTRY_PERSISTENCE
+  persistChanges();
+#endif
+  return ok;
+}
+
+bool NFCBuildingRegistry::deserialize(const uint8_t* data, size_t size, uint32_t* version) {
+  NFCBufferStream in(data, size);
+  return deserialize(in, version);
+}
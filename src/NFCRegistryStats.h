@@ -0,0 +1,86 @@
+#ifndef NFC_REGISTRY_STATS_H
+#define NFC_REGISTRY_STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+
+// Scan pipeline instrumentation (NFC_REGISTRY_STATS). Latencies are kept as
+// fixed log2 histograms: bucket b counts samples of [2^b, 2^(b+1)) us, bucket
+// 0 also takes 0 us and the last bucket everything slower.
+#define NFC_STATS_BUCKETS 20
+
+enum class ScanStage : uint8_t {
+  Detect,    // REQA for new cards and each check for its answer (one sample per step)
+  Select,    // anticollision + select (PICC_ReadCardSerial)
+  ReadNdef,  // all CC/NDEF reads of one tap, summed
+  Parse,     // NDEF parsing / building type resolution
+  LockWait,  // acquiring the storage lock for a write
+  Callbacks, // one event (or batch) delivered to the application
+  Log,       // one log line written (shared by all registries)
+  Count
+};
+
+struct NFCStageStats {
+  uint32_t count;
+  uint32_t maxMicros;
+  uint32_t histogram[NFC_STATS_BUCKETS];
+};
+
+struct NFCRegistryStats {
+  NFCStageStats stages[static_cast<size_t>(ScanStage::Count)];
+  uint32_t reads;          // cards selected by a scan
+  uint32_t ndefFailures;   // NDEF read but no valid building record
+  uint32_t uidFallbacks;   // no NDEF data, building type taken from the UID
+  uint32_t adds;           // buildings added by a scan
+  uint32_t removes;        // buildings removed by a scan (delete mode)
+  uint32_t reTaps;         // taps of cards already registered
+  uint32_t lockContention; // writer found the storage lock taken (not counted for spinlocks)
+  uint32_t hashHits;       // re-taps confirmed by the NDEF hash (KnownCardPolicy::VerifyHash)
+  uint32_t rewrites;       // registered cards re-read with a different type or card data
+
+  const NFCStageStats& stage(ScanStage s) const { return stages[static_cast<size_t>(s)]; }
+};
+
+// Lock-free recorder behind one NFCStageStats; safe to update from any task
+class NFCStageRecorder {
+public:
+  NFCStageRecorder() { reset(); }
+
+  void record(uint32_t micros) {
+    count.fetch_add(1, std::memory_order_relaxed);
+    histogram[bucketOf(micros)].fetch_add(1, std::memory_order_relaxed);
+    uint32_t seen = maxMicros.load(std::memory_order_relaxed);
+    while (micros > seen && !maxMicros.compare_exchange_weak(seen, micros, std::memory_order_relaxed)) {
+    }
+  }
+
+  void copyTo(NFCStageStats& out) const {
+    out.count = count.load(std::memory_order_relaxed);
+    out.maxMicros = maxMicros.load(std::memory_order_relaxed);
+    for (size_t b = 0; b < NFC_STATS_BUCKETS; b++) {
+      out.histogram[b] = histogram[b].load(std::memory_order_relaxed);
+    }
+  }
+
+  void reset() {
+    count.store(0, std::memory_order_relaxed);
+    maxMicros.store(0, std::memory_order_relaxed);
+    for (size_t b = 0; b < NFC_STATS_BUCKETS; b++) {
+      histogram[b].store(0, std::memory_order_relaxed);
+    }
+  }
+
+  static size_t bucketOf(uint32_t micros) {
+    size_t bucket = micros ? static_cast<size_t>(31 - __builtin_clz(micros)) : 0;
+    return bucket < NFC_STATS_BUCKETS ? bucket : NFC_STATS_BUCKETS - 1;
+  }
+
+private:
+  std::atomic<uint32_t> count;
+  std::atomic<uint32_t> maxMicros;
+  std::atomic<uint32_t> histogram[NFC_STATS_BUCKETS];
+};
+
+#endif // NFC_REGISTRY_STATS_H